@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# End-to-end benchmark of the update path: gupcli checks and downloads
+# against the local HTTP stand-in (standIn.py), then latency and throughput
+# are summarized over all the iterations.
+#
+# usage: ./bench.sh [ITERATIONS] [PACKAGE_SIZE_MB]
+#
+# Extra arguments can be passed through the environment, e.g. to compare
+# a segmented download against a server throttling each connection:
+#   STANDIN_ARGS="--rate 2000000" GUPCLI_ARGS="--segments 4" ./bench.sh 5 20
+# or a delta update against a full download:
+#   STANDIN_ARGS="--delta" ./bench.sh 5 20
+#   STANDIN_ARGS="--delta" GUPCLI_ARGS="--no-delta" ./bench.sh 5 20
+# or mirrors, the first one answering later, the second one throttled:
+#   STANDIN_ARGS="--mirrors 200,0:500000,0" GUPCLI_ARGS="--min-speed 1000 --min-speed-time 2" ./bench.sh 5 20
+
+set -e
+
+ITERATIONS=${1:-20}
+PACKAGE_SIZE_MB=${2:-50}
+
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+server=
+trap '[ -n "$server" ] && kill $server 2>/dev/null; rm -rf "$work"' EXIT
+
+python3 "$here/standIn.py" --port 0 --package-size $((PACKAGE_SIZE_MB * 1024 * 1024)) $STANDIN_ARGS > "$work/port" &
+server=$!
+while [ ! -s "$work/port" ]; do sleep 0.1; done
+port=$(head -n 1 "$work/port")
+
+# With --delta, the package of the previous version has to be where gupcli looks for the base of the delta
+case "$STANDIN_ARGS" in *--delta*)
+	python3 -c 'import sys, urllib.request; urllib.request.urlretrieve(sys.argv[1], sys.argv[2])' \
+		"http://127.0.0.1:$port/base-bench.Installer.exe" "$work/base-bench.Installer.exe" ;;
+esac
+
+cat > "$work/gup.xml" <<XML
+<?xml version="1.0" ?>
+<GUPInput>
+	<Version>4.6</Version>
+	<InfoUrl>http://127.0.0.1:$port/getDownloadUrl.php</InfoUrl>
+	<SoftwareName>Bench</SoftwareName>
+</GUPInput>
+XML
+
+i=0
+while [ $i -lt "$ITERATIONS" ]; do
+	# Else the next run finds the package ready, without downloading it
+	rm -f "$work/bench.Installer.exe"
+	"$here/gupcli" --config "$work/gup.xml" --options "$work/gupOptions.xml" --dest "$work" --yes --stats $GUPCLI_ARGS >> "$work/stats"
+	i=$((i + 1))
+done
+
+# Print min/median/p95/mean (in ms) of one "key=seconds" field of the stats lines
+summarize() {
+	sed -n "s/.* $1=\([0-9.]*\).*/\1/p" "$work/stats" | sort -g | awk -v name="$1" '
+		{ v[NR] = $1 * 1000; sum += v[NR] }
+		END {
+			p95 = int(NR * 0.95 + 0.5); if (p95 < 1) p95 = 1
+			printf "%-10s min %9.2f ms   median %9.2f ms   p95 %9.2f ms   mean %9.2f ms\n", name, v[1], v[int((NR + 1) / 2)], v[p95], sum / NR
+		}'
+}
+
+echo "$ITERATIONS iterations, ${PACKAGE_SIZE_MB} MB package"
+summarize check
+summarize probe
+summarize download
+# 0 when the download goes on the connection of the check
+summarize dlConnect
+summarize patch
+awk '{ for (i = 1; i <= NF; i++) { split($i, kv, "="); if (kv[1] == "download") t += kv[2]; if (kv[1] == "bytes") b += kv[2] } }
+	END { if (t > 0) printf "throughput %.1f MB/s\n", b / t / 1048576 }' "$work/stats"
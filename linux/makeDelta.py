@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+#
+# Makes a GUP delta (see src/patchApplier.h) from the package of the previous
+# version (the base) to the update package, e.g. to publish next to it in a
+# <Delta> of the update info.
+#
+# usage: makeDelta.py BASE_PACKAGE UPDATE_PACKAGE DELTA
+#
+# Blocks of the base are indexed, then the update package is scanned for them:
+# what is found is copied from the base, the rest is inserted. It's meant for
+# packages which mostly didn't change (minor releases), not as a general diff.
+
+import hashlib
+import struct
+import sys
+
+
+BLOCK_SIZE = 1024  # the base is indexed every BLOCK_SIZE bytes
+KEY_SIZE = 32      # by the first KEY_SIZE bytes of the block
+
+
+def match_length(a, a_start, b, b_start):
+    length = 0
+    step = 64 * 1024
+    while True:
+        x = a[a_start + length:a_start + length + step]
+        y = b[b_start + length:b_start + length + step]
+        if x == y and len(x) == step:
+            length += step
+            continue
+        # Bisect the first difference of the last chunk
+        low, high = 0, min(len(x), len(y))
+        while low < high:
+            middle = (low + high + 1) // 2
+            if x[:middle] == y[:middle]:
+                low = middle
+            else:
+                high = middle - 1
+        return length + low
+
+
+def make_delta(base, target):
+    base = memoryview(base).tobytes()
+    target = memoryview(target).tobytes()
+
+    index = {}
+    for offset in range(0, len(base) - KEY_SIZE + 1, BLOCK_SIZE):
+        index.setdefault(base[offset:offset + KEY_SIZE], offset)
+
+    commands = []
+    insert_start = 0
+    i = 0
+    while i < len(target):
+        offset = index.get(target[i:i + KEY_SIZE])
+        if offset is not None:
+            length = match_length(base, offset, target, i)
+            if length >= KEY_SIZE:
+                if insert_start < i:
+                    commands.append(b"I" + struct.pack("<Q", i - insert_start) + target[insert_start:i])
+                commands.append(b"C" + struct.pack("<QQ", offset, length))
+                i += length
+                insert_start = i
+                continue
+        i += 1
+
+    if insert_start < len(target):
+        commands.append(b"I" + struct.pack("<Q", len(target) - insert_start) + target[insert_start:])
+    commands.append(b"E")
+
+    header = b"GUPDIFF1" + struct.pack("<QQ", len(base), len(target)) + hashlib.sha256(target).digest()
+    return header + b"".join(commands)
+
+
+def main():
+    if len(sys.argv) != 4:
+        sys.exit("usage: makeDelta.py BASE_PACKAGE UPDATE_PACKAGE DELTA")
+
+    with open(sys.argv[1], "rb") as f:
+        base = f.read()
+    with open(sys.argv[2], "rb") as f:
+        target = f.read()
+
+    delta = make_delta(base, target)
+    with open(sys.argv[3], "wb") as f:
+        f.write(delta)
+    print("%s: %d bytes (%.1fx smaller than the package)" % (sys.argv[3], len(delta), len(target) / max(len(delta), 1)))
+
+
+if __name__ == "__main__":
+    main()
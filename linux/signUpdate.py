@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+#
+# Signs what WinGup checks with the public keys of gup.xml (<PublicKey>), Ed25519 (RFC 8032).
+#
+# usage: signUpdate.py keygen SECRET_KEY_FILE     prints the public key to pin in gup.xml
+#        signUpdate.py info SECRET_KEY_FILE FILE  signature of an update info, for its GUP-Signature header
+#        signUpdate.py package SECRET_KEY_FILE PACKAGE
+#                                                 signature of a package, for the <Signature> of the update info
+#
+# A package is signed through its SHA-256: WinGup hashes it while it's downloaded anyway,
+# and checks the signature of this digest. Keys and signatures are in hexadecimal.
+#
+# Pure Python and slow (a fraction of a second per signature): it's for the publisher and the tests,
+# keep the secret key somewhere safe.
+
+import hashlib
+import os
+import sys
+
+P = 2 ** 255 - 19
+L = 2 ** 252 + 27742317777372353535851937790883648493
+D = -121665 * pow(121666, P - 2, P) % P
+SQRT_M1 = pow(2, (P - 1) // 4, P)
+
+
+def point_add(p, q):
+    a = (p[1] - p[0]) * (q[1] - q[0]) % P
+    b = (p[1] + p[0]) * (q[1] + q[0]) % P
+    c = 2 * p[3] * q[3] * D % P
+    d = 2 * p[2] * q[2] % P
+    e, f, g, h = b - a, d - c, d + c, b + a
+    return (e * f % P, g * h % P, f * g % P, e * h % P)
+
+
+def point_mul(s, p):
+    q = (0, 1, 1, 0)
+    while s > 0:
+        if s & 1:
+            q = point_add(q, p)
+        p = point_add(p, p)
+        s >>= 1
+    return q
+
+
+def recover_x(y, sign):
+    x2 = (y * y - 1) * pow(D * y * y + 1, P - 2, P)
+    x = pow(x2, (P + 3) // 8, P)
+    if (x * x - x2) % P:
+        x = x * SQRT_M1 % P
+    if (x & 1) != sign:
+        x = P - x
+    return x
+
+
+G_Y = 4 * pow(5, P - 2, P) % P
+G = (recover_x(G_Y, 0), G_Y, 1, recover_x(G_Y, 0) * G_Y % P)
+
+
+def point_compress(p):
+    z_inv = pow(p[2], P - 2, P)
+    x, y = p[0] * z_inv % P, p[1] * z_inv % P
+    return int.to_bytes(y | ((x & 1) << 255), 32, "little")
+
+
+def sha512_int(data):
+    return int.from_bytes(hashlib.sha512(data).digest(), "little")
+
+
+def expand_secret(secret):
+    h = hashlib.sha512(secret).digest()
+    a = int.from_bytes(h[:32], "little")
+    a &= (1 << 254) - 8
+    a |= 1 << 254
+    return a, h[32:]
+
+
+def public_key(secret):
+    return point_compress(point_mul(expand_secret(secret)[0], G))
+
+
+def sign(secret, message):
+    a, prefix = expand_secret(secret)
+    a_bytes = point_compress(point_mul(a, G))
+    r = sha512_int(prefix + message) % L
+    r_bytes = point_compress(point_mul(r, G))
+    h = sha512_int(r_bytes + a_bytes + message) % L
+    s = (r + h * a) % L
+    return r_bytes + int.to_bytes(s, 32, "little")
+
+
+def sign_package(secret, package):
+    return sign(secret, hashlib.sha256(package).digest())
+
+
+def main():
+    if len(sys.argv) < 3 or sys.argv[1] not in ("keygen", "info", "package") or (sys.argv[1] != "keygen" and len(sys.argv) != 4):
+        sys.exit("usage: signUpdate.py keygen|info|package SECRET_KEY_FILE [FILE]")
+
+    if sys.argv[1] == "keygen":
+        secret = os.urandom(32)
+        with open(sys.argv[2], "w") as f:
+            f.write(secret.hex() + "\n")
+        print(public_key(secret).hex())
+        return
+
+    with open(sys.argv[2]) as f:
+        secret = bytes.fromhex(f.read().strip())
+    with open(sys.argv[3], "rb") as f:
+        data = f.read()
+    print((sign(secret, data) if sys.argv[1] == "info" else sign_package(secret, data)).hex())
+
+
+if __name__ == "__main__":
+    main()
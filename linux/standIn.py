@@ -0,0 +1,380 @@
+#!/usr/bin/env python3
+#
+# Local HTTP stand-in for an update server, used by bench.sh to exercise gupcli.
+#
+# It answers InfoUrl requests (/getDownloadUrl.php?version=...) like
+# src/ConfigFiles/getDownLoadUrl.php does, and serves a generated update package.
+#
+# The listening port is printed on the first line of stdout (use --port 0 to
+# let the system pick a free one).
+#
+# With --delta, it also serves the package of the previous version
+# (base-<package name>) and a delta from it (<package name>.gupdiff).
+#
+# With --mirrors, the update info lists several Location: /mirror<i>/<package name>,
+# each one with its own answer delay, rate and fault (see parse_mirrors).
+#
+# --busy, --min-check-interval and --rollout send the hints which spread the
+# update checks of a fleet of clients over time.
+#
+# --manifest binary answers the clients which accept it with the binary manifest
+# (see GupDownloadInfo in src/xmlTools.h), --gzip compresses the update info.
+#
+# /update.xml is the static manifest of the latest version, the same for every client
+# (<InfoUrl static="yes"> in gup.xml): the clients compare the versions themselves.
+# --channel adds a release channel to it (<Channel> in gup.xml), for the same package.
+#
+# --sign signs the update info (GUP-Signature header) and the package (<Signature>)
+# with a secret key of signUpdate.py.
+
+import argparse
+import gzip
+import hashlib
+import http.server
+import random
+import re
+import sys
+import time
+import urllib.parse
+
+import makeDelta
+import signUpdate
+
+
+LAST_MODIFIED = "Sat, 01 Jan 2022 00:00:00 GMT"
+
+MANIFEST_TYPE = "application/x-gup-manifest"
+
+
+def release_xml(info, version, indent):
+    nodes = "%s<Version>%s</Version>\n" % (indent, version)
+    nodes += "".join("%s<Location>%s</Location>\n" % (indent, location) for location in info["locations"])
+    if info["sha256"]:
+        nodes += "%s<Hash algo=\"sha256\">%s</Hash>\n" % (indent, info["sha256"])
+    if info["signature"]:
+        nodes += "%s<Signature>%s</Signature>\n" % (indent, info["signature"])
+    return nodes
+
+
+def to_xml(info):
+    # need is None in a static manifest
+    nodes = ""
+    if info["need"] is not None:
+        nodes += "\t<NeedToBeUpdated>%s</NeedToBeUpdated>\n" % ("yes" if info["need"] else "no")
+    if info["need"] is not False:
+        nodes += release_xml(info, info["version"], "\t")
+        for delta_from, location, base in info["deltas"]:
+            nodes += ("\t<Delta from=\"%s\">\n\t\t<Location>%s</Location>\n\t\t<Base>%s</Base>\n\t</Delta>\n"
+                      % (delta_from, location, base))
+    for name, version, rollout in info["channels"]:
+        nodes += "\t<Channel name=\"%s\">\n%s" % (name, release_xml(info, version, "\t\t"))
+        if rollout < 100:
+            nodes += "\t\t<Rollout>%d</Rollout>\n" % rollout
+        nodes += "\t</Channel>\n"
+    if info["min_check_interval"]:
+        nodes += "\t<MinCheckInterval>%d</MinCheckInterval>\n" % info["min_check_interval"]
+    if info["rollout"] < 100:
+        nodes += "\t<Rollout>%d</Rollout>\n" % info["rollout"]
+    return ("<?xml version=\"1.0\"?>\n<GUP>\n%s</GUP>\n" % nodes).encode()
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        out.append(byte | 0x80 if value else byte)
+        if not value:
+            return bytes(out)
+
+
+def record(tag, value):
+    if isinstance(value, int):
+        value = varint(value)
+    elif isinstance(value, str):
+        value = value.encode()
+    return bytes([tag]) + varint(len(value)) + value
+
+
+def release_records(info, version):
+    out = record(2, version)
+    out += b"".join(record(3, location) for location in info["locations"])
+    if info["sha256"]:
+        out += record(5, bytes.fromhex(info["sha256"]))
+    if info["signature"]:
+        out += record(10, bytes.fromhex(info["signature"]))
+    return out
+
+
+def to_manifest(info):
+    out = b"GUPM\x01"
+    if info["need"] is not None:
+        out += record(1, 1 if info["need"] else 0)
+    if info["need"] is not False:
+        out += release_records(info, info["version"])
+        for delta_from, location, base in info["deltas"]:
+            out += record(6, record(1, delta_from) + record(2, location) + record(3, base))
+    for name, version, rollout in info["channels"]:
+        out += record(11, record(12, name) + release_records(info, version) + (record(9, rollout) if rollout < 100 else b""))
+    if info["min_check_interval"]:
+        out += record(8, info["min_check_interval"])
+    if info["rollout"] < 100:
+        out += record(9, info["rollout"])
+    return out
+
+
+def make_base(package):
+    # The previous version: some bytes changed every MB, and a part the update package has added
+    base = bytearray(package)
+    for offset in range(0, len(base), 1024 * 1024):
+        base[offset:offset + 64] = bytes(len(base[offset:offset + 64]))
+    del base[len(base) // 3:len(base) // 3 + 4096]
+    return bytes(base)
+
+
+def parse_mirrors(spec):
+    # DELAY[:RATE[:FAULT]],... with DELAY in milliseconds, RATE in bytes per second per connection (0: --rate)
+    # and FAULT "bad" (serves a corrupted package) or "dead" (answers 503)
+    mirrors = []
+    for item in spec.split(",") if spec else []:
+        fields = item.split(":")
+        mirrors.append({"delay": int(fields[0]) / 1000,
+                        "rate": int(fields[1]) if len(fields) > 1 and fields[1] else 0,
+                        "fault": fields[2] if len(fields) > 2 else ""})
+    return mirrors
+
+
+def make_handler(args, package, base, delta):
+    # Another --latest or --package-size is another package
+    etag = "\"%s-%d\"" % (args.latest, len(package))
+    sha256 = hashlib.sha256(package).hexdigest()
+    if args.hash == "bad":
+        sha256 = sha256[::-1]
+    mirrors = parse_mirrors(args.mirrors)
+    # NAME:VERSION[:ROLLOUT] of --channel
+    channels = []
+    for spec in args.channel:
+        fields = spec.split(":")
+        channels.append((fields[0], fields[1], int(fields[2]) if len(fields) > 2 else 100))
+    corrupted = bytes(b ^ 0xff for b in package[:4096]) + package[4096:]
+    secret_key = None
+    package_signature = ""
+    if args.sign:
+        with open(args.sign) as f:
+            secret_key = bytes.fromhex(f.read().strip())
+        # The signature is of the announced digest: with --hash bad, the package doesn't match it
+        package_signature = signUpdate.sign(secret_key, bytes.fromhex(sha256)).hex()
+
+    class StandInHandler(http.server.BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"
+        # Like the real servers: on a kept-alive connection, Nagle would hold the body until the client acks the headers
+        disable_nagle_algorithm = True
+
+        def log_message(self, fmt, *log_args):
+            if args.verbose:
+                sys.stderr.write("standIn: " + (fmt % log_args) + "\n")
+
+        def handle(self):
+            # Clients giving up (time budget exceeded, download aborted) are expected
+            try:
+                super().handle()
+            except ConnectionError:
+                pass
+
+        def send_body(self, body, content_type):
+            self.send_response(200)
+            self.send_header("Content-Type", content_type)
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            if self.command != "HEAD":
+                self.wfile.write(body)
+
+        def send_update_info(self, info):
+            # --info-delay: a server slow to answer
+            time.sleep(args.info_delay / 1000)
+            if args.busy:
+                self.send_response(503)
+                self.send_header("Retry-After", str(args.busy))
+                self.send_header("Content-Length", "0")
+                self.end_headers()
+                return
+            content_type, body = "text/xml", to_xml(info)
+            if args.manifest == "binary" and MANIFEST_TYPE in self.headers.get("Accept", ""):
+                content_type, body = MANIFEST_TYPE, to_manifest(info)
+            content_encoding = None
+            signature = signUpdate.sign(secret_key, body).hex() if secret_key else ""
+            if args.gzip and "gzip" in self.headers.get("Accept-Encoding", ""):
+                content_encoding, body = "gzip", gzip.compress(body, mtime=0)
+            # Each representation has its own ETag
+            info_etag = "\"%s\"" % hashlib.sha1(body).hexdigest()[:16]
+            if self.headers.get("If-None-Match") == info_etag:
+                self.send_response(304)
+            else:
+                self.send_response(200)
+                self.send_header("Content-Type", content_type)
+                if content_encoding:
+                    self.send_header("Content-Encoding", content_encoding)
+                self.send_header("Content-Length", str(len(body)))
+            self.send_header("Vary", "Accept, Accept-Encoding")
+            if signature:
+                self.send_header("GUP-Signature", signature)
+            self.send_header("ETag", info_etag)
+            self.send_header("Cache-Control", "max-age=%d" % args.info_max_age)
+            self.end_headers()
+            if self.command != "HEAD" and self.headers.get("If-None-Match") != info_etag:
+                self.wfile.write(body)
+
+        def send_package(self, package, etag, rate=0):
+            first, last = 0, len(package) - 1
+            match = re.match(r"bytes=(\d*)-(\d*)$", self.headers.get("Range", ""))
+            # If-Range: the range is sent only if the package is still the same, else the whole package
+            if_range = self.headers.get("If-Range")
+            is_same = if_range is None or if_range in (etag, LAST_MODIFIED)
+            if match and not args.no_ranges and is_same and (match.group(1) or match.group(2)):
+                if match.group(1):
+                    first = int(match.group(1))
+                    last = min(int(match.group(2)), last) if match.group(2) else last
+                else:
+                    first = max(len(package) - int(match.group(2)), 0)
+                if first > last:
+                    self.send_response(416)
+                    self.send_header("Content-Range", "bytes */%d" % len(package))
+                    self.send_header("Content-Length", "0")
+                    self.end_headers()
+                    return
+                self.send_response(206)
+                self.send_header("Content-Range", "bytes %d-%d/%d" % (first, last, len(package)))
+            else:
+                self.send_response(200)
+            if not args.no_ranges:
+                self.send_header("Accept-Ranges", "bytes")
+            self.send_header("ETag", etag)
+            self.send_header("Last-Modified", LAST_MODIFIED)
+            self.send_header("Content-Type", "application/octet-stream")
+            self.send_header("Content-Length", str(last - first + 1))
+            self.end_headers()
+            if self.command == "HEAD":
+                return
+
+            # --rate throttles each connection, like a CDN does
+            rate = rate or args.rate
+            chunk = 64 * 1024 if not rate or rate >= 256 * 1024 else 4 * 1024
+            started = time.monotonic()
+            sent = 0
+            while first + sent <= last:
+                data = package[first + sent:min(first + sent + chunk, last + 1)]
+                try:
+                    self.wfile.write(data)
+                except ConnectionError:
+                    # The client aborted the download
+                    return
+                sent += len(data)
+                if rate:
+                    delay = sent / rate - (time.monotonic() - started)
+                    if delay > 0:
+                        time.sleep(delay)
+
+        def do_GET(self):
+            url = urllib.parse.urlsplit(self.path)
+            if url.path == "/getDownloadUrl.php":
+                query = urllib.parse.parse_qs(url.query)
+                version = query.get("version", [""])[0]
+                self.send_update_info(self.update_info(version))
+            elif url.path == "/update.xml":
+                self.send_update_info(self.update_info(None))
+            elif url.path == "/" + args.package_name:
+                self.send_package(package, etag)
+            elif re.match(r"/mirror\d+/", url.path) and url.path.endswith("/" + args.package_name):
+                self.send_mirror(int(url.path[len("/mirror"):url.path.index("/", 1)]))
+            elif base and url.path == "/base-" + args.package_name:
+                self.send_package(base, "\"base-%d\"" % len(base))
+            elif delta and url.path == "/%s.gupdiff" % args.package_name:
+                self.send_package(delta, "\"%s-%d.gupdiff\"" % (args.latest, len(delta)))
+            else:
+                self.send_error(404)
+
+        do_HEAD = do_GET
+
+        def send_mirror(self, index):
+            if index >= len(mirrors):
+                self.send_error(404)
+                return
+            mirror = mirrors[index]
+            time.sleep(mirror["delay"])
+            if mirror["fault"] == "dead":
+                self.send_error(503)
+            else:
+                # Each server has its own ETag
+                served = corrupted if mirror["fault"] == "bad" else package
+                self.send_package(served, "\"m%d-%s\"" % (index, etag.strip("\"")), mirror["rate"])
+
+        def update_info(self, version):
+            # The fields of the answer, sent as XML or as binary manifest
+            info = {"need": None if version is None else version != args.latest, "min_check_interval": args.min_check_interval,
+                    "rollout": 100 if version == args.latest else args.rollout}
+            location = "http://%s/%s" % (self.headers.get("Host"), args.package_name)
+            info["version"] = args.latest
+            info["locations"] = [location]
+            if mirrors:
+                info["locations"] = ["http://%s/mirror%d/%s" % (self.headers.get("Host"), i, args.package_name)
+                                     for i in range(len(mirrors))]
+            info["sha256"] = "" if args.hash == "none" else sha256
+            info["signature"] = "" if args.hash == "none" else package_signature
+            # Whatever the version of the client, the base package is the one of its version
+            info["deltas"] = []
+            if delta and version is not None:
+                info["deltas"].append((version, location + ".gupdiff", "http://%s/base-%s" % (self.headers.get("Host"), args.package_name)))
+            info["channels"] = channels if version is None else []
+            return info
+
+    return StandInHandler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=0)
+    parser.add_argument("--latest", default="4.7", help="version of the served package")
+    parser.add_argument("--package-name", default="bench.Installer.exe")
+    parser.add_argument("--package-size", type=int, default=8 * 1024 * 1024, help="in bytes")
+    parser.add_argument("--info-max-age", type=int, default=0, help="Cache-Control max-age of the update info, in seconds")
+    parser.add_argument("--info-delay", type=int, default=0, help="delay of the update info answers, in milliseconds")
+    parser.add_argument("--rate", type=int, default=0, help="bytes per second per connection (0: unlimited)")
+    parser.add_argument("--no-ranges", action="store_true", help="ignore Range requests")
+    parser.add_argument("--hash", choices=("good", "bad", "none"), default="good",
+                        help="SHA-256 announced in the update info (bad: one which doesn't match)")
+    parser.add_argument("--delta", action="store_true", help="also serve a previous package and a delta from it")
+    parser.add_argument("--mirrors", default="", help="list the package on mirrors: DELAY[:RATE[:bad|dead]],...")
+    parser.add_argument("--busy", type=int, default=0, help="answer InfoUrl with 503 and this Retry-After, in seconds")
+    parser.add_argument("--min-check-interval", type=int, default=0, help="MinCheckInterval of the update info, in seconds")
+    parser.add_argument("--rollout", type=int, default=100, help="Rollout percentage of the update info")
+    parser.add_argument("--manifest", choices=("xml", "binary"), default="xml",
+                        help="binary: answer with the binary manifest the clients which accept it")
+    parser.add_argument("--gzip", action="store_true", help="compress the update info for the clients which accept it")
+    parser.add_argument("--channel", action="append", default=[], metavar="NAME:VERSION[:ROLLOUT]",
+                        help="add a release channel to the static manifest, repeatable")
+    parser.add_argument("--sign", metavar="SECRET_KEY_FILE", help="sign the update info and the package (see signUpdate.py)")
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    base, delta = None, None
+    if args.delta:
+        # A repeated pattern would make any delta trivial
+        package = random.Random(args.latest).randbytes(args.package_size)
+        base = make_base(package)
+        delta = makeDelta.make_delta(base, package)
+    else:
+        pattern = bytes(range(256))
+        package = (pattern * (args.package_size // len(pattern) + 1))[:args.package_size]
+
+    # A fleet of simulated clients (gupcli --fleet) connects at once: a backlog of 5 would drop most SYNs
+    http.server.ThreadingHTTPServer.request_queue_size = 1024
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", args.port), make_handler(args, package, base, delta))
+    print(server.server_address[1], flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -16,13 +16,14 @@
     along with GUP.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-$lastestVersion = 1.23; // X.YZ
+// Compared as versions, not as numbers: 1.10 is after 1.9.
+// A static file (see gupReponseExample.xml) saves this script altogether: WinGup compares the versions itself.
 $lastestVersionStr = "1.2.3"; // X.Y.Z
 $DLURL = "http://download.my-software.com/my-software/1.2.3/mySoftware.1.2.3.Installer.exe";
 $curentVersion = $_GET["version"];
 $param = $_GET["param"]; // optional
 
-if ($curentVersion >= $lastestVersion)
+if (version_compare($curentVersion, $lastestVersionStr, ">="))
 {
 	echo 
 "<?xml version=\"1.0\"?>
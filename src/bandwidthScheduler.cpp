@@ -0,0 +1,139 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include "bandwidthScheduler.h"
+
+using namespace std;
+
+// The rate is adapted this often: a few RTT of a slow link
+const chrono::milliseconds RATE_INTERVAL(250);
+
+// The budget starts again from zero this often: no credit piles up while the server is slow
+const chrono::milliseconds BUDGET_WINDOW(1000);
+
+// Queuing delay tolerated in background mode, in microseconds
+const int64_t TARGET_DELAY = 50 * 1000;
+
+// Never slower than that, in bytes per second: the download still ends
+const int64_t MIN_RATE = 16 * 1024;
+
+void BandwidthScheduler::start(int64_t received)
+{
+	_rate = _maxRate;
+	_baseRtt = -1;
+	_rtt = -1;
+	resume(received);
+}
+
+void BandwidthScheduler::resume(int64_t received)
+{
+	_isStarted = false;
+	_intervalReceived = received;
+	_windowReceived = received;
+}
+
+void BandwidthScheduler::update(const chrono::steady_clock::time_point & now, int64_t received, int64_t rttUs)
+{
+	if (!_isStarted)
+	{
+		_isStarted = true;
+		_intervalStart = now;
+		_intervalReceived = received;
+		_windowStart = now;
+		_windowReceived = received;
+		return;
+	}
+
+	if (rttUs > 0)
+	{
+		_rtt = rttUs;
+		if (_baseRtt < 0 || rttUs < _baseRtt)
+			_baseRtt = rttUs;
+	}
+
+	auto elapsed = now - _intervalStart;
+	if (elapsed < RATE_INTERVAL)
+		return;
+
+	// Nothing received: the RTT hasn't been measured again either
+	int64_t intervalReceived = received - _intervalReceived;
+	int64_t throughput = static_cast<int64_t>(intervalReceived / chrono::duration<double>(elapsed).count());
+	_intervalStart = now;
+	_intervalReceived = received;
+
+	// Without RTT (not available on this system), only the cap applies
+	if (!_isAdaptive || _rtt < 0 || intervalReceived == 0)
+		return;
+
+	int64_t rate = _rate;
+	int64_t delay = _rtt - _baseRtt;
+	if (delay > TARGET_DELAY)
+	{
+		// Someone else needs the link: back off from what we actually got
+		int64_t current = max(rate > 0 ? min(rate, throughput) : throughput, MIN_RATE);
+		double overTarget = min(static_cast<double>(delay - TARGET_DELAY) / TARGET_DELAY, 2.0);
+		rate = max(current - static_cast<int64_t>(current / 8 * overTarget), MIN_RATE);
+	}
+	else if (rate > 0 && throughput >= rate / 2)
+	{
+		// The link is idle: grow, less as the delay gets closer to the target.
+		// A rate the download doesn't reach anyway (slow server) isn't raised.
+		int64_t step = max(rate / 8, MIN_RATE);
+		rate += step * (TARGET_DELAY - delay) / TARGET_DELAY;
+	}
+
+	if (_maxRate > 0)
+		rate = rate > 0 ? min(rate, _maxRate) : _maxRate;
+
+	if (rate != _rate)
+	{
+		// What has been received over the budget is still owed at the new rate
+		int64_t excess = getExcess(now, received);
+		_rate = rate;
+		_windowStart = now;
+		_windowReceived = received - max<int64_t>(excess, 0);
+	}
+}
+
+int64_t BandwidthScheduler::getExcess(const chrono::steady_clock::time_point & now, int64_t received) const
+{
+	if (_rate <= 0)
+		return 0;
+
+	double seconds = chrono::duration<double>(now - _windowStart).count();
+	return received - _windowReceived - static_cast<int64_t>(_rate * seconds);
+}
+
+long BandwidthScheduler::getDelay(const chrono::steady_clock::time_point & now, int64_t received)
+{
+	if (_rate <= 0 || !_isStarted)
+		return 0;
+
+	int64_t excess = getExcess(now, received);
+	if (excess > 0)
+		return static_cast<long>(excess * 1000 / _rate) + 1;
+
+	if (now - _windowStart >= BUDGET_WINDOW)
+	{
+		_windowStart = now;
+		_windowReceived = received;
+	}
+	return 0;
+}
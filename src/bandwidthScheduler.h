@@ -0,0 +1,82 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BANDWIDTHSCHEDULER_H
+#define BANDWIDTHSCHEDULER_H
+
+#include <stdint.h>
+#include <chrono>
+
+//
+// Bandwidth policy of a download which shouldn't get in the way of the other users of the link:
+// a fixed cap, and/or a background mode which only uses the bandwidth nobody else is using (like LEDBAT).
+//
+// In background mode, the round trip time of the connection tells if the link is busy: above the lowest one
+// seen (base RTT), the packets are waiting in the queue of a router. While this queuing delay stays under
+// the target, the rate grows; over it, the rate drops, the further over the faster, to drain the queue.
+//
+// The rate is enforced by pausing the transfers (getDelay) rather than with CURLOPT_MAX_RECV_SPEED_LARGE,
+// which curl averages from the start of the transfer: lowered after a fast start, it would stall it.
+//
+class BandwidthScheduler
+{
+public:
+	// In bytes per second, 0: no cap
+	void setPolicy(int64_t maxRate, bool isAdaptive) { _maxRate = maxRate; _isAdaptive = isAdaptive; };
+	int64_t getMaxRate() const { return _maxRate; };
+	bool isAdaptive() const { return _isAdaptive; };
+	bool isActive() const { return _maxRate > 0 || _isAdaptive; };
+
+	// A transfer starts: its base RTT is measured again, it may go to another server
+	void start(int64_t received);
+	// The transfer goes on after a pause: the rate is measured again from there
+	void resume(int64_t received);
+
+	// Called as often as possible during the transfer, with all the bytes received so far
+	// and the current RTT in microseconds (-1 if unknown)
+	void update(const std::chrono::steady_clock::time_point & now, int64_t received, int64_t rttUs);
+
+	// Milliseconds to wait before receiving more to keep to the rate, 0: go on
+	long getDelay(const std::chrono::steady_clock::time_point & now, int64_t received);
+
+	// What the download may use now, in bytes per second, 0: no limit
+	int64_t getRate() const { return _rate; };
+
+private:
+	int64_t _maxRate = 0;
+	bool _isAdaptive = false;
+
+	int64_t _rate = 0;
+	int64_t _baseRtt = -1;
+	int64_t _rtt = -1;
+
+	// Adaptation of the rate
+	bool _isStarted = false;
+	std::chrono::steady_clock::time_point _intervalStart;
+	int64_t _intervalReceived = 0;
+
+	// Budget of the rate: what may be received since the start of the window
+	std::chrono::steady_clock::time_point _windowStart;
+	int64_t _windowReceived = 0;
+
+	// Bytes received over the budget so far (negative: still allowed)
+	int64_t getExcess(const std::chrono::steady_clock::time_point & now, int64_t received) const;
+};
+
+#endif // BANDWIDTHSCHEDULER_H
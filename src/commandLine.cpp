@@ -0,0 +1,172 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdlib>
+#include "commandLine.h"
+
+using namespace std;
+
+static bool isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+vector<string> GupCommandLine::split(const char *cmdLine)
+{
+	vector<string> args;
+	if (!cmdLine)
+		return args;
+
+	const char *p = cmdLine;
+	for (;;)
+	{
+		while (isBlank(*p))
+			++p;
+		if (!*p)
+			return args;
+
+		string arg;
+		bool isQuoted = false;
+		while (*p && (isQuoted || !isBlank(*p)))
+		{
+			if (*p == '\\')
+			{
+				// 2n backslashes and a quote: n backslashes, then the quote opens or closes.
+				// 2n+1 and a quote: n backslashes and a quote. Without a quote after them, they are what they are
+				size_t count = 0;
+				while (*p == '\\')
+				{
+					++count;
+					++p;
+				}
+				if (*p == '"')
+				{
+					arg.append(count / 2, '\\');
+					if (count % 2)
+					{
+						arg += '"';
+						++p;
+					}
+				}
+				else
+				{
+					arg.append(count, '\\');
+				}
+			}
+			else if (*p == '"')
+			{
+				// "" within quotes is a quote
+				if (isQuoted && p[1] == '"')
+				{
+					arg += '"';
+					++p;
+				}
+				else
+				{
+					isQuoted = !isQuoted;
+				}
+				++p;
+			}
+			else
+			{
+				arg += *p++;
+			}
+		}
+		args.push_back(arg);
+	}
+}
+
+string GupCommandLine::quote(const string & arg)
+{
+	if (!arg.empty() && arg.find_first_of(" \t\r\n\"") == string::npos)
+		return arg;
+
+	string quoted = "\"";
+	size_t backslashes = 0;
+	for (char c : arg)
+	{
+		if (c == '\\')
+		{
+			++backslashes;
+			continue;
+		}
+
+		// Before a quote, the backslashes are doubled, and the quote escaped
+		quoted.append(c == '"' ? backslashes * 2 + 1 : backslashes, '\\');
+		backslashes = 0;
+		quoted += c;
+	}
+	// So are the ones before the closing quote
+	quoted.append(backslashes * 2, '\\');
+	return quoted + "\"";
+}
+
+// A count of milliseconds or of connections: digits only, not a negative nor an overflowing number
+static bool parseCount(const string & value, long & count)
+{
+	if (value.empty() || value.size() > 9 || value.find_first_not_of("0123456789") != string::npos)
+		return false;
+	count = atol(value.c_str());
+	return true;
+}
+
+GupCommandLine::GupCommandLine(const char *cmdLine)
+{
+	vector<string> args = split(cmdLine);
+	for (size_t i = 0; i < args.size(); ++i)
+	{
+		const string & arg = args[i];
+		const string *value = i + 1 < args.size() ? &args[i + 1] : NULL;
+		long count = 0;
+
+		if (arg == "--help")
+			isHelp = true;
+		else if (arg == "-options")
+			isOptionsDlg = true;
+		else if (arg == "-verbose")
+			isVerbose = true;
+		else if (arg == "--check-timeout" && value && parseCount(*value, count))
+		{
+			checkTimeout = count;
+			++i;
+		}
+		else if (arg == "--connect-timeout" && value && parseCount(*value, count))
+		{
+			connectTimeout = count;
+			++i;
+		}
+		else if (arg == "--segments" && value && parseCount(*value, count) && count > 0)
+		{
+			segmentCount = static_cast<int>(count);
+			++i;
+		}
+		else if (arg == "--cache-dir" && value)
+			cacheDir = args[++i];
+		else if (arg == "--log" && value)
+			logPath = args[++i];
+		else if (arg.size() > 2 && arg[0] == '-' && arg[1] == 'v')
+			version = arg.substr(2);
+		else if (arg.size() > 2 && arg[0] == '-' && arg[1] == 'p')
+			customParam = arg.substr(2);
+		else if (arg.size() > 2 && arg[0] == '-' && arg[1] == 'c')
+			configList = arg.substr(2);
+		else
+			ignored.push_back(arg);
+	}
+}
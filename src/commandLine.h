@@ -0,0 +1,56 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include <string>
+#include <vector>
+
+//
+// The command line of WinGup, read in one pass into its options.
+//
+// It is split into arguments with the rules of CommandLineToArgvW: blanks separate them, except within
+// double quotes, and backslashes only escape the quotes: "C:\Program Files\gup.xml" is one argument, and
+// so is -p"x64 portable" (-px64 portable). The old flags keep their form, the value stuck to the letter
+// (-v8.6.9, -px64, -cCONFIG_LIST); the newer ones take theirs as the next argument (--log FILE).
+//
+struct GupCommandLine
+{
+	explicit GupCommandLine(const char *cmdLine);
+
+	bool isHelp = false;           // --help
+	bool isOptionsDlg = false;     // -options
+	bool isVerbose = false;        // -verbose
+	std::string version;           // -vVERSION_VALUE
+	std::string customParam;       // -pCUSTOM_PARAM
+	std::string configList;        // -cCONFIG_LIST
+	long checkTimeout = -1;        // --check-timeout MS, -1: the one of gupOptions.xml
+	long connectTimeout = -1;      // --connect-timeout MS, -1: the one of gupOptions.xml
+	int segmentCount = 0;          // --segments N, 0: the one of gupOptions.xml
+	std::string cacheDir;          // --cache-dir DIR
+	std::string logPath;           // --log FILE
+	std::vector<std::string> ignored;  // unknown flags, and the flags without a valid value
+
+	static std::vector<std::string> split(const char *cmdLine);
+	// The argument, quoted if it has to be, so that split() gives it back
+	static std::string quote(const std::string & arg);
+};
+
+#endif // COMMANDLINE_H
@@ -0,0 +1,546 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Verification only: WinGup never signs. The field and group arithmetic follows TweetNaCl
+// (public domain): not the fastest, but short, and constant time doesn't matter for public data.
+//
+
+#include <cstring>
+#include "ed25519.h"
+
+using namespace std;
+
+static const uint64_t K[80] = {
+	0x428a2f98d728ae22, 0x7137449123ef65cd, 0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc,
+	0x3956c25bf348b538, 0x59f111f1b605d019, 0x923f82a4af194f9b, 0xab1c5ed5da6d8118,
+	0xd807aa98a3030242, 0x12835b0145706fbe, 0x243185be4ee4b28c, 0x550c7dc3d5ffb4e2,
+	0x72be5d74f27b896f, 0x80deb1fe3b1696b1, 0x9bdc06a725c71235, 0xc19bf174cf692694,
+	0xe49b69c19ef14ad2, 0xefbe4786384f25e3, 0x0fc19dc68b8cd5b5, 0x240ca1cc77ac9c65,
+	0x2de92c6f592b0275, 0x4a7484aa6ea6e483, 0x5cb0a9dcbd41fbd4, 0x76f988da831153b5,
+	0x983e5152ee66dfab, 0xa831c66d2db43210, 0xb00327c898fb213f, 0xbf597fc7beef0ee4,
+	0xc6e00bf33da88fc2, 0xd5a79147930aa725, 0x06ca6351e003826f, 0x142929670a0e6e70,
+	0x27b70a8546d22ffc, 0x2e1b21385c26c926, 0x4d2c6dfc5ac42aed, 0x53380d139d95b3df,
+	0x650a73548baf63de, 0x766a0abb3c77b2a8, 0x81c2c92e47edaee6, 0x92722c851482353b,
+	0xa2bfe8a14cf10364, 0xa81a664bbc423001, 0xc24b8b70d0f89791, 0xc76c51a30654be30,
+	0xd192e819d6ef5218, 0xd69906245565a910, 0xf40e35855771202a, 0x106aa07032bbd1b8,
+	0x19a4c116b8d2d0c8, 0x1e376c085141ab53, 0x2748774cdf8eeb99, 0x34b0bcb5e19b48a8,
+	0x391c0cb3c5c95a63, 0x4ed8aa4ae3418acb, 0x5b9cca4f7763e373, 0x682e6ff3d6b2b8a3,
+	0x748f82ee5defb2fc, 0x78a5636f43172f60, 0x84c87814a1f0ab72, 0x8cc702081a6439ec,
+	0x90befffa23631e28, 0xa4506cebde82bde9, 0xbef9a3f7b2c67915, 0xc67178f2e372532b,
+	0xca273eceea26619c, 0xd186b8c721c0c207, 0xeada7dd6cde0eb1e, 0xf57d4f7fee6ed178,
+	0x06f067aa72176fba, 0x0a637dc5a2c898a6, 0x113f9804bef90dae, 0x1b710b35131c471b,
+	0x28db77f523047d84, 0x32caab7b40c72493, 0x3c9ebe0a15c9bebc, 0x431d67c49c100d4c,
+	0x4cc5d4becb3e42b6, 0x597f299cfc657e2a, 0x5fcb6fab3ad6faec, 0x6c44198c4a475817
+};
+
+static inline uint64_t rotr(uint64_t x, int n)
+{
+	return (x >> n) | (x << (64 - n));
+}
+
+void Sha512::reset()
+{
+	static const uint64_t init[8] = {
+		0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+		0x510e527fade682d1, 0x9b05688c2b3e6c1f, 0x1f83d9abfb41bd6b, 0x5be0cd19137e2179
+	};
+	memcpy(_h, init, sizeof(_h));
+	_length = 0;
+}
+
+void Sha512::transform(const unsigned char *block)
+{
+	uint64_t w[80];
+	for (int i = 0; i < 16; ++i)
+	{
+		w[i] = 0;
+		for (int j = 0; j < 8; ++j)
+			w[i] = (w[i] << 8) | block[i * 8 + j];
+	}
+
+	for (int i = 16; i < 80; ++i)
+	{
+		uint64_t s0 = rotr(w[i - 15], 1) ^ rotr(w[i - 15], 8) ^ (w[i - 15] >> 7);
+		uint64_t s1 = rotr(w[i - 2], 19) ^ rotr(w[i - 2], 61) ^ (w[i - 2] >> 6);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint64_t a = _h[0], b = _h[1], c = _h[2], d = _h[3], e = _h[4], f = _h[5], g = _h[6], h = _h[7];
+	for (int i = 0; i < 80; ++i)
+	{
+		uint64_t s1 = rotr(e, 14) ^ rotr(e, 18) ^ rotr(e, 41);
+		uint64_t ch = (e & f) ^ (~e & g);
+		uint64_t t1 = h + s1 + ch + K[i] + w[i];
+		uint64_t s0 = rotr(a, 28) ^ rotr(a, 34) ^ rotr(a, 39);
+		uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+		uint64_t t2 = s0 + maj;
+
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	_h[0] += a;
+	_h[1] += b;
+	_h[2] += c;
+	_h[3] += d;
+	_h[4] += e;
+	_h[5] += f;
+	_h[6] += g;
+	_h[7] += h;
+}
+
+void Sha512::update(const void *data, size_t len)
+{
+	const unsigned char *bytes = static_cast<const unsigned char *>(data);
+	size_t pending = static_cast<size_t>(_length % 128);
+	_length += len;
+
+	if (pending > 0)
+	{
+		size_t fill = 128 - pending;
+		if (len < fill)
+		{
+			memcpy(_block + pending, bytes, len);
+			return;
+		}
+		memcpy(_block + pending, bytes, fill);
+		transform(_block);
+		bytes += fill;
+		len -= fill;
+	}
+
+	for (; len >= 128; bytes += 128, len -= 128)
+		transform(bytes);
+
+	memcpy(_block, bytes, len);
+}
+
+void Sha512::finish(unsigned char *digest)
+{
+	// Messages over 2^61 bytes don't fit in the upper half of the length
+	uint64_t bitLength = _length * 8;
+	unsigned char padding[128 + 16] = { 0x80 };
+	size_t pending = static_cast<size_t>(_length % 128);
+	size_t padLength = (pending < 112 ? 112 : 240) - pending;
+	for (int i = 0; i < 8; ++i)
+		padding[padLength + 8 + i] = static_cast<unsigned char>(bitLength >> (56 - i * 8));
+	update(padding, padLength + 16);
+
+	for (int i = 0; i < 64; ++i)
+		digest[i] = static_cast<unsigned char>(_h[i / 8] >> (56 - (i % 8) * 8));
+}
+
+//
+// Field elements modulo 2^255 - 19: 16 limbs of 16 bits
+//
+typedef int64_t Field[16];
+
+static const Field fieldZero = { 0 };
+static const Field fieldOne = { 1 };
+static const Field curveD = { 0x78a3, 0x1359, 0x4dca, 0x75eb, 0xd8ab, 0x4141, 0x0a4d, 0x0070, 0xe898, 0x7779, 0x4079, 0x8cc7, 0xfe73, 0x2b6f, 0x6cee, 0x5203 };
+static const Field curveD2 = { 0xf159, 0x26b2, 0x9b94, 0xebd6, 0xb156, 0x8283, 0x149a, 0x00e0, 0xd130, 0xeef3, 0x80f2, 0x198e, 0xfce7, 0x56df, 0xd9dc, 0x2406 };
+static const Field baseX = { 0xd51a, 0x8f25, 0x2d60, 0xc956, 0xa7b2, 0x9525, 0xc760, 0x692c, 0xdc5c, 0xfdd6, 0xe231, 0xc0a4, 0x53fe, 0xcd6e, 0x36d3, 0x2169 };
+static const Field baseY = { 0x6658, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666, 0x6666 };
+static const Field sqrtMinusOne = { 0xa0b0, 0x4a0e, 0x1b27, 0xc4ee, 0xe478, 0xad2f, 0x1806, 0x2f43, 0xd7a7, 0x3dfb, 0x0099, 0x2b4d, 0xdf0b, 0x4fc1, 0x2480, 0x2b83 };
+
+// Order of the base point, little endian
+static const int64_t groupOrder[32] = {
+	0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10
+};
+
+static void copyField(Field r, const Field a)
+{
+	for (int i = 0; i < 16; ++i)
+		r[i] = a[i];
+}
+
+static void carry(Field o)
+{
+	for (int i = 0; i < 16; ++i)
+	{
+		o[i] += 1 << 16;
+		int64_t c = o[i] >> 16;
+		if (i < 15)
+			o[i + 1] += c - 1;
+		else
+			o[0] += 38 * (c - 1);
+		o[i] -= c * 65536;
+	}
+}
+
+// Swaps p and q if b is 1
+static void swapIf(Field p, Field q, int b)
+{
+	int64_t mask = ~(static_cast<int64_t>(b) - 1);
+	for (int i = 0; i < 16; ++i)
+	{
+		int64_t t = mask & (p[i] ^ q[i]);
+		p[i] ^= t;
+		q[i] ^= t;
+	}
+}
+
+static void packField(unsigned char *o, const Field n)
+{
+	Field m, t;
+	copyField(t, n);
+	carry(t);
+	carry(t);
+	carry(t);
+	for (int j = 0; j < 2; ++j)
+	{
+		m[0] = t[0] - 0xffed;
+		for (int i = 1; i < 15; ++i)
+		{
+			m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+			m[i - 1] &= 0xffff;
+		}
+		m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+		int b = static_cast<int>((m[15] >> 16) & 1);
+		m[14] &= 0xffff;
+		swapIf(t, m, 1 - b);
+	}
+	for (int i = 0; i < 16; ++i)
+	{
+		o[2 * i] = static_cast<unsigned char>(t[i] & 0xff);
+		o[2 * i + 1] = static_cast<unsigned char>(t[i] >> 8);
+	}
+}
+
+static bool isFieldEqual(const Field a, const Field b)
+{
+	unsigned char c[32], d[32];
+	packField(c, a);
+	packField(d, b);
+	return memcmp(c, d, 32) == 0;
+}
+
+static int parity(const Field a)
+{
+	unsigned char d[32];
+	packField(d, a);
+	return d[0] & 1;
+}
+
+static void unpackField(Field o, const unsigned char *n)
+{
+	for (int i = 0; i < 16; ++i)
+		o[i] = n[2 * i] + (static_cast<int64_t>(n[2 * i + 1]) << 8);
+	o[15] &= 0x7fff;
+}
+
+static void add(Field o, const Field a, const Field b)
+{
+	for (int i = 0; i < 16; ++i)
+		o[i] = a[i] + b[i];
+}
+
+static void subtract(Field o, const Field a, const Field b)
+{
+	for (int i = 0; i < 16; ++i)
+		o[i] = a[i] - b[i];
+}
+
+static void multiply(Field o, const Field a, const Field b)
+{
+	int64_t t[31] = { 0 };
+	for (int i = 0; i < 16; ++i)
+	{
+		for (int j = 0; j < 16; ++j)
+			t[i + j] += a[i] * b[j];
+	}
+	for (int i = 0; i < 15; ++i)
+		t[i] += 38 * t[i + 16];
+	for (int i = 0; i < 16; ++i)
+		o[i] = t[i];
+	carry(o);
+	carry(o);
+}
+
+static void square(Field o, const Field a)
+{
+	multiply(o, a, a);
+}
+
+static void invert(Field o, const Field i)
+{
+	Field c;
+	copyField(c, i);
+	for (int a = 253; a >= 0; --a)
+	{
+		square(c, c);
+		if (a != 2 && a != 4)
+			multiply(c, c, i);
+	}
+	copyField(o, c);
+}
+
+// i^((p - 5) / 8)
+static void pow2523(Field o, const Field i)
+{
+	Field c;
+	copyField(c, i);
+	for (int a = 250; a >= 0; --a)
+	{
+		square(c, c);
+		if (a != 1)
+			multiply(c, c, i);
+	}
+	copyField(o, c);
+}
+
+//
+// Points of the curve, in extended coordinates (X, Y, Z, T)
+//
+static void addPoint(Field p[4], Field q[4])
+{
+	Field a, b, c, d, t, e, f, g, h;
+	subtract(a, p[1], p[0]);
+	subtract(t, q[1], q[0]);
+	multiply(a, a, t);
+	add(b, p[0], p[1]);
+	add(t, q[0], q[1]);
+	multiply(b, b, t);
+	multiply(c, p[3], q[3]);
+	multiply(c, c, curveD2);
+	multiply(d, p[2], q[2]);
+	add(d, d, d);
+	subtract(e, b, a);
+	subtract(f, d, c);
+	add(g, d, c);
+	add(h, b, a);
+
+	multiply(p[0], e, f);
+	multiply(p[1], h, g);
+	multiply(p[2], g, f);
+	multiply(p[3], e, h);
+}
+
+static void selectPoint(Field p[4], Field q[4], int b)
+{
+	for (int i = 0; i < 4; ++i)
+		swapIf(p[i], q[i], b);
+}
+
+static void packPoint(unsigned char *r, Field p[4])
+{
+	Field tx, ty, zi;
+	invert(zi, p[2]);
+	multiply(tx, p[0], zi);
+	multiply(ty, p[1], zi);
+	packField(r, ty);
+	r[31] ^= static_cast<unsigned char>(parity(tx) << 7);
+}
+
+// p = s * q, q is modified
+static void scalarMultiply(Field p[4], Field q[4], const unsigned char *s)
+{
+	copyField(p[0], fieldZero);
+	copyField(p[1], fieldOne);
+	copyField(p[2], fieldOne);
+	copyField(p[3], fieldZero);
+	for (int i = 255; i >= 0; --i)
+	{
+		int b = (s[i / 8] >> (i & 7)) & 1;
+		selectPoint(p, q, b);
+		addPoint(q, p);
+		addPoint(p, p);
+		selectPoint(p, q, b);
+	}
+}
+
+static void scalarMultiplyBase(Field p[4], const unsigned char *s)
+{
+	Field q[4];
+	copyField(q[0], baseX);
+	copyField(q[1], baseY);
+	copyField(q[2], fieldOne);
+	multiply(q[3], baseX, baseY);
+	scalarMultiply(p, q, s);
+}
+
+// The opposite of the point of this public key, false if it isn't on the curve
+static bool unpackNegativePoint(Field r[4], const unsigned char *p)
+{
+	Field t, check, num, den, den2, den4, den6;
+	copyField(r[2], fieldOne);
+	unpackField(r[1], p);
+	square(num, r[1]);
+	multiply(den, num, curveD);
+	subtract(num, num, r[2]);
+	add(den, r[2], den);
+
+	square(den2, den);
+	square(den4, den2);
+	multiply(den6, den4, den2);
+	multiply(t, den6, num);
+	multiply(t, t, den);
+
+	pow2523(t, t);
+	multiply(t, t, num);
+	multiply(t, t, den);
+	multiply(t, t, den);
+	multiply(r[0], t, den);
+
+	square(check, r[0]);
+	multiply(check, check, den);
+	if (!isFieldEqual(check, num))
+		multiply(r[0], r[0], sqrtMinusOne);
+
+	square(check, r[0]);
+	multiply(check, check, den);
+	if (!isFieldEqual(check, num))
+		return false;
+
+	if (parity(r[0]) == (p[31] >> 7))
+		subtract(r[0], fieldZero, r[0]);
+
+	multiply(r[3], r[0], r[1]);
+	return true;
+}
+
+// r = x mod the group order
+static void reduceScalar(unsigned char *r, int64_t x[64])
+{
+	int64_t c = 0;
+	for (int i = 63; i >= 32; --i)
+	{
+		c = 0;
+		int j = i - 32;
+		for (; j < i - 12; ++j)
+		{
+			x[j] += c - 16 * x[i] * groupOrder[j - (i - 32)];
+			c = (x[j] + 128) >> 8;
+			x[j] -= c * 256;
+		}
+		x[j] += c;
+		x[i] = 0;
+	}
+
+	c = 0;
+	for (int j = 0; j < 32; ++j)
+	{
+		x[j] += c - (x[31] >> 4) * groupOrder[j];
+		c = x[j] >> 8;
+		x[j] &= 255;
+	}
+	for (int j = 0; j < 32; ++j)
+		x[j] -= c * groupOrder[j];
+	for (int i = 0; i < 32; ++i)
+	{
+		x[i + 1] += x[i] >> 8;
+		r[i] = static_cast<unsigned char>(x[i] & 255);
+	}
+}
+
+// S must be below the group order, or the same message would have several valid signatures
+static bool isCanonicalScalar(const unsigned char *s)
+{
+	for (int i = 31; i >= 0; --i)
+	{
+		if (s[i] != groupOrder[i])
+			return s[i] < groupOrder[i];
+	}
+	return false;
+}
+
+bool Ed25519Verifier::begin(const unsigned char *publicKey, const unsigned char *signature)
+{
+	memcpy(_publicKey, publicKey, PUBLIC_KEY_SIZE);
+	memcpy(_signature, signature, SIGNATURE_SIZE);
+
+	// SHA-512(R || A || message)
+	_hash.reset();
+	_hash.update(_signature, 32);
+	_hash.update(_publicKey, PUBLIC_KEY_SIZE);
+	return isCanonicalScalar(_signature + 32);
+}
+
+void Ed25519Verifier::update(const void *data, size_t len)
+{
+	_hash.update(data, len);
+}
+
+bool Ed25519Verifier::finish()
+{
+	Field minusA[4];
+	if (!isCanonicalScalar(_signature + 32) || !unpackNegativePoint(minusA, _publicKey))
+		return false;
+
+	unsigned char digest[64];
+	_hash.finish(digest);
+	int64_t x[64];
+	for (int i = 0; i < 64; ++i)
+		x[i] = digest[i];
+	unsigned char h[32];
+	reduceScalar(h, x);
+
+	// [S]B - [h]A must be R
+	Field p[4], q[4];
+	scalarMultiply(p, minusA, h);
+	scalarMultiplyBase(q, _signature + 32);
+	addPoint(p, q);
+
+	unsigned char r[32];
+	packPoint(r, p);
+	return memcmp(r, _signature, 32) == 0;
+}
+
+static bool readHex(const string & hex, unsigned char *bytes, size_t size)
+{
+	if (hex.size() != size * 2)
+		return false;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		int value = 0;
+		for (int j = 0; j < 2; ++j)
+		{
+			char c = hex[i * 2 + j];
+			int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+			if (digit < 0)
+				return false;
+			value = value * 16 + digit;
+		}
+		bytes[i] = static_cast<unsigned char>(value);
+	}
+	return true;
+}
+
+bool Ed25519Verifier::verify(const string & publicKeyHex, const string & signatureHex, const void *data, size_t len)
+{
+	unsigned char publicKey[PUBLIC_KEY_SIZE];
+	unsigned char signature[SIGNATURE_SIZE];
+	if (!readHex(publicKeyHex, publicKey, PUBLIC_KEY_SIZE) || !readHex(signatureHex, signature, SIGNATURE_SIZE))
+		return false;
+
+	Ed25519Verifier verifier;
+	if (!verifier.begin(publicKey, signature))
+		return false;
+	verifier.update(data, len);
+	return verifier.finish();
+}
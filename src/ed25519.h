@@ -0,0 +1,68 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ED25519_H
+#define ED25519_H
+
+#include <stdint.h>
+#include <string>
+
+// SHA-512, the hash of Ed25519
+class Sha512
+{
+public:
+	Sha512() { reset(); };
+
+	void reset();
+	void update(const void *data, size_t len);
+	// The 64 bytes of the digest. The object must be reset() before reusing it
+	void finish(unsigned char *digest);
+
+private:
+	uint64_t _h[8];
+	uint64_t _length;           // bytes hashed so far
+	unsigned char _block[128];  // pending bytes: _length % 128 of them
+
+	void transform(const unsigned char *block);
+};
+
+// Ed25519 signature verification (RFC 8032), incremental like Sha256.
+// The signature is detached, so it's known before the message: its R and the public key
+// start the hash of the message, which can then be checked while it is received.
+class Ed25519Verifier
+{
+public:
+	static const size_t PUBLIC_KEY_SIZE = 32;
+	static const size_t SIGNATURE_SIZE = 64;
+
+	// False if the signature can't be valid
+	bool begin(const unsigned char *publicKey, const unsigned char *signature);
+	void update(const void *data, size_t len);
+	bool finish();
+
+	// Key and signature in hexadecimal, as in gup.xml and in the update info
+	static bool verify(const std::string & publicKeyHex, const std::string & signatureHex, const void *data, size_t len);
+
+private:
+	Sha512 _hash;
+	unsigned char _publicKey[PUBLIC_KEY_SIZE];
+	unsigned char _signature[SIGNATURE_SIZE];
+};
+
+#endif // ED25519_H
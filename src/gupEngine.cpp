@@ -0,0 +1,2359 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "ed25519.h"
+#include "gupEngine.h"
+#include "outputFile.h"
+#include "patchApplier.h"
+#include "resource.h"
+#ifdef _WIN32
+#define CURL_STATICLIB
+#include "../curl/include/curl/curl.h"
+#else
+// The headers of the libcurl it's linked with (see linux/Makefile)
+#include <curl/curl.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+const char PATH_SEPARATOR = '\\';
+#else
+const char PATH_SEPARATOR = '/';
+#endif
+
+// Each range of a segmented download is at least 1 MB
+const int64_t MIN_SEGMENT_SIZE = 1024 * 1024;
+
+// Mirrors are given that long to answer, in milliseconds
+const long MIRROR_PROBE_TIMEOUT = 3000;
+
+// A download checks its pause and bandwidth policy at least this often, in milliseconds
+const long TRANSFER_POLL_TIMEOUT = 100;
+
+// Answers of InfoUrl kept between runs, in the cache directory
+const char INFOCACHE_FILENAME[] = "gupInfoCache.xml";
+
+// The binary manifest first (see GupDownloadInfo), the XML from the servers which don't know it
+const char MANIFEST_ACCEPT_HEADER[] = "Accept: application/x-gup-manifest, text/xml;q=0.9, */*;q=0.1";
+
+// When the server allows the next check, in the cache directory too
+const char SCHEDULE_FILENAME[] = "gupSchedule.xml";
+
+// No server hint puts the update checks off longer than that, in seconds: a wrong one can't stop the updates
+const int64_t MAX_CHECK_DELAY = 30 * 24 * 3600;
+
+// A package source of the local network answers quickly or not at all, in milliseconds
+const long PACKAGE_SOURCE_CONNECT_TIMEOUT = 2000;
+
+// Time given to the copy of the package to a package source, in milliseconds
+const long PACKAGE_PUBLISH_TIMEOUT = 60000;
+
+static double secondsSince(const chrono::steady_clock::time_point & start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// This is the getUpdateInfo call back function used by curl
+static size_t getUpdateInfoCallback(char *data, size_t size, size_t nmemb, std::string *updateInfo)
+{
+	// What we will return
+	size_t len = size * nmemb;
+
+	// Is there anything in the buffer?
+	if (updateInfo != NULL)
+	{
+		// Append the data to the buffer
+		updateInfo->append(data, len);
+	}
+
+	return len;
+}
+
+// Headers of the answer we need to split or resume a download
+struct ResponseHeaders
+{
+	bool acceptRanges = false;
+	std::string etag;
+	std::string lastModified;
+	int64_t maxAge = -1;   // Cache-Control: max-age, -1 if absent
+	bool noStore = false;  // Cache-Control: no-store
+	int64_t retryAfter = 0;  // Retry-After, in seconds from now
+	std::string signature;   // GUP-Signature: Ed25519 signature of the body, in hexadecimal
+};
+
+// curl_easy_perform on a multi handle, to give up at the deadline instead of blocking until curl does
+static CURLcode performUntil(CURL *curl, const chrono::steady_clock::time_point & deadline)
+{
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return CURLE_OUT_OF_MEMORY;
+
+	curl_multi_add_handle(multi, curl);
+	CURLcode res = CURLE_OPERATION_TIMEDOUT;
+	for (;;)
+	{
+		int running = 0;
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+		{
+			res = CURLE_FAILED_INIT;
+			break;
+		}
+
+		CURLMsg *msg = NULL;
+		int msgsLeft = 0;
+		bool isDone = false;
+		while ((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL)
+		{
+			if (msg->msg == CURLMSG_DONE)
+			{
+				res = msg->data.result;
+				isDone = true;
+			}
+		}
+		if (isDone)
+			break;
+
+		auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+		if (left <= 0)
+			break;
+		curl_multi_poll(multi, NULL, 0, static_cast<int>(min<long long>(left, 1000)), NULL);
+	}
+
+	curl_multi_remove_handle(multi, curl);
+	curl_multi_cleanup(multi);
+	return res;
+}
+
+// What the transfers of an engine share for the whole run (curl share interface): the connections, the DNS answers
+// and the TLS sessions. The package download goes on the connection of the update check when they have the same host,
+// without a second TCP connect nor TLS handshake
+struct GupSession
+{
+	CURLSH *share = NULL;
+	// The transfers of one engine run on one thread, the locks are for the sessions shared between threads
+	mutex locks[CURL_LOCK_DATA_LAST];
+
+	GupSession()
+	{
+		share = curl_share_init();
+		if (!share)
+			return;
+
+		curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lock);
+		curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlock);
+		curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	};
+
+	~GupSession()
+	{
+		// The handles using it are all cleaned up by now
+		if (share)
+			curl_share_cleanup(share);
+	};
+
+	static void lock(CURL *, curl_lock_data data, curl_lock_access, void *session)
+	{
+		static_cast<GupSession *>(session)->locks[data].lock();
+	};
+
+	static void unlock(CURL *, curl_lock_data data, void *session)
+	{
+		static_cast<GupSession *>(session)->locks[data].unlock();
+	};
+};
+
+static double getTime(CURL *curl, CURLINFO info)
+{
+	curl_off_t us = 0;
+	return curl_easy_getinfo(curl, info, &us) == CURLE_OK ? us / 1e6 : 0;
+}
+
+static void getTransferTimes(CURL *curl, GupTransferTimes & times, std::string *ip = NULL)
+{
+	char *primaryIp = NULL;
+	if (ip && curl_easy_getinfo(curl, CURLINFO_PRIMARY_IP, &primaryIp) == CURLE_OK && primaryIp)
+		*ip = primaryIp;
+
+	times.nameLookup = getTime(curl, CURLINFO_NAMELOOKUP_TIME_T);
+	times.connect = getTime(curl, CURLINFO_CONNECT_TIME_T);
+	times.appConnect = getTime(curl, CURLINFO_APPCONNECT_TIME_T);
+	times.startTransfer = getTime(curl, CURLINFO_STARTTRANSFER_TIME_T);
+	times.total = getTime(curl, CURLINFO_TOTAL_TIME_T);
+
+	long newConnections = 0;
+	times.isReused = curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &newConnections) == CURLE_OK && newConnections == 0;
+	long httpVersion = 0;
+	curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &httpVersion);
+	times.httpVersion = httpVersion == CURL_HTTP_VERSION_1_0 ? "1.0" : httpVersion == CURL_HTTP_VERSION_1_1 ? "1.1" :
+		httpVersion == CURL_HTTP_VERSION_2_0 ? "2" : httpVersion == CURL_HTTP_VERSION_3 ? "3" : "";
+}
+
+static int watchSocketCallback(void *socket, curl_socket_t sock, curlsocktype)
+{
+	*static_cast<curl_socket_t *>(socket) = sock;
+	return CURL_SOCKOPT_OK;
+}
+
+// curl only tells the socket of a transfer once it's over: keep it when it's opened
+static void watchSocket(CURL *curl, curl_socket_t *socket)
+{
+	*socket = CURL_SOCKET_BAD;
+	curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, watchSocketCallback);
+	curl_easy_setopt(curl, CURLOPT_SOCKOPTDATA, socket);
+}
+
+// RTT of a connection receiving data in microseconds, as the TCP stack measures it: -1 if unknown.
+// The usual RTT is measured on the data sent, which is only the request here: the receiver side one is needed.
+static int64_t getRoundTripTime(curl_socket_t sock)
+{
+#ifdef __linux__
+	struct tcp_info info;
+	socklen_t size = sizeof(info);
+	if (sock != CURL_SOCKET_BAD && getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &size) == 0 && info.tcpi_rcv_rtt > 0)
+		return static_cast<int64_t>(info.tcpi_rcv_rtt);
+#else
+	(void)sock;
+#endif
+	return -1;
+}
+
+#ifndef _WIN32
+// The priorities of the process before enterBackgroundMode(), put back by leaveBackgroundMode()
+struct ForegroundPriority
+{
+	bool isSaved = false;
+	int nice = 0;
+	long ioPriority = -1;
+};
+static ForegroundPriority foregroundPriority;
+#endif
+
+// Let the host application, which may be starting too, have the CPU and the disk first during the update check
+static void enterBackgroundMode()
+{
+#ifdef _WIN32
+	::SetPriorityClass(::GetCurrentProcess(), PROCESS_MODE_BACKGROUND_BEGIN);
+#else
+	if (!foregroundPriority.isSaved)
+	{
+		errno = 0;
+		int nice = getpriority(PRIO_PROCESS, 0);
+		if (errno != 0)
+			return;
+		foregroundPriority.nice = nice;
+#ifdef __linux__
+		// ioprio_get(IOPRIO_WHO_PROCESS, this process)
+		foregroundPriority.ioPriority = syscall(SYS_ioprio_get, 1, 0);
+#endif
+		foregroundPriority.isSaved = true;
+	}
+
+	setpriority(PRIO_PROCESS, 0, 10);
+#ifdef __linux__
+	// ioprio_set(IOPRIO_WHO_PROCESS, this process, IOPRIO_CLASS_IDLE), which glibc doesn't wrap
+	syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+#endif
+}
+
+// The download the user waits for and the installer don't run in the background.
+// An unprivileged process can't lower its nice value again (RLIMIT_NICE): on Unix, only the disk priority comes back then
+static void leaveBackgroundMode()
+{
+#ifdef _WIN32
+	::SetPriorityClass(::GetCurrentProcess(), PROCESS_MODE_BACKGROUND_END);
+#else
+	if (!foregroundPriority.isSaved)
+		return;
+
+	setpriority(PRIO_PROCESS, 0, foregroundPriority.nice);
+#ifdef __linux__
+	if (foregroundPriority.ioPriority >= 0)
+		syscall(SYS_ioprio_set, 1, 0, foregroundPriority.ioPriority);
+#endif
+	foregroundPriority.isSaved = false;
+#endif
+}
+
+static size_t getResponseHeaders(char *data, size_t size, size_t nmemb, ResponseHeaders *headers)
+{
+	size_t len = size * nmemb;
+	string header(data, len);
+	string::size_type colon = header.find(':');
+	string name = header.substr(0, colon);
+	transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+	string value;
+	if (colon != string::npos)
+	{
+		string::size_type first = header.find_first_not_of(" \t", colon + 1);
+		string::size_type last = header.find_last_not_of(" \t\r\n");
+		if (first != string::npos && last >= first)
+			value = header.substr(first, last - first + 1);
+	}
+
+	// Headers of the redirections are received too, only the last answer counts
+	if (name.compare(0, 5, "http/") == 0)
+		*headers = ResponseHeaders();
+	else if (name == "accept-ranges")
+		headers->acceptRanges = value.find("bytes") != string::npos;
+	else if (name == "etag")
+		headers->etag = value;
+	else if (name == "last-modified")
+		headers->lastModified = value;
+	else if (name == "cache-control")
+	{
+		transform(value.begin(), value.end(), value.begin(), ::tolower);
+		if (value.find("no-store") != string::npos)
+			headers->noStore = true;
+		if (value.find("no-cache") != string::npos)
+			headers->maxAge = 0;
+		else if (value.find("max-age=") != string::npos)
+			headers->maxAge = strtoll(value.c_str() + value.find("max-age=") + 8, NULL, 10);
+	}
+	else if (name == "gup-signature")
+		headers->signature = value;
+	else if (name == "retry-after")
+	{
+		// Seconds or HTTP-date
+		if (!value.empty() && isdigit(static_cast<unsigned char>(value[0])))
+			headers->retryAfter = strtoll(value.c_str(), NULL, 10);
+		else if (curl_getdate(value.c_str(), NULL) > 0)
+			headers->retryAfter = max<int64_t>(curl_getdate(value.c_str(), NULL) - time(NULL), 0);
+	}
+
+	return len;
+}
+
+// Package received on one connection
+struct StreamDownload
+{
+	GupEngineCallbacks *callbacks = NULL;
+	OutputFile *file = NULL;
+	CoalescingWriter *writer = NULL;
+	CURL *curl = NULL;
+	int64_t resumeFrom = 0;
+	int64_t offset = 0;  // where the next received byte goes
+	Sha256 *hash = NULL; // NULL if the package isn't verified
+	GupEngineStats *stats = NULL;
+	curl_socket_t socket = CURL_SOCKET_BAD;
+	const bool *isPaused = NULL;  // GupEngine::_isPaused: curl still calls the progress function meanwhile
+	bool isPreallocated = false;
+	std::string writeError;
+};
+
+static size_t getDownloadData(char *data, size_t size, size_t nmemb, StreamDownload *download)
+{
+	// A short count makes curl fail with CURLE_WRITE_ERROR (disk full...)
+	size_t len = size * nmemb;
+
+	// As soon as the size is known, reserve the space of the whole package: a full disk fails now, not at the end
+	if (!download->isPreallocated)
+	{
+		download->isPreallocated = true;
+		curl_off_t contentLength = -1;
+		if (curl_easy_getinfo(download->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength) == CURLE_OK && contentLength > 0 &&
+			!download->file->preallocate(download->offset + contentLength))
+		{
+			download->writeError = "Not enough disk space to download the package.";
+			return 0;
+		}
+	}
+
+	if (!download->writer->write(data, len, download->offset))
+	{
+		download->writeError = "Cannot write the package.";
+		return 0;
+	}
+
+	// Hashed while it streams in: verifying the package doesn't read it again
+	if (download->hash)
+	{
+		auto start = chrono::steady_clock::now();
+		download->hash->update(data, len);
+		download->stats->verifyTime += secondsSince(start);
+	}
+
+	download->offset += len;
+	return len;
+}
+
+static int getDownloadProgress(void *clientp, curl_off_t dlTotal, curl_off_t dlNow, curl_off_t, curl_off_t)
+{
+	// curl counts from the resume point, the callbacks count from the beginning of the package
+	StreamDownload *download = static_cast<StreamDownload *>(clientp);
+	if (*download->isPaused)
+		return 0;
+	int64_t total = dlTotal > 0 ? download->resumeFrom + dlTotal : 0;
+	return download->callbacks->onProgress(total, download->resumeFrom + dlNow) ? 0 : 1;
+}
+
+// Range downloaded by one connection of a segmented download
+struct DownloadSegment
+{
+	std::unique_ptr<CoalescingWriter> writer;
+	int64_t start = 0;
+	int64_t offset = 0;  // where the next received byte goes
+	int64_t end = 0;     // last byte of the range
+	Sha256 *hash = NULL;
+	GupEngineStats *stats = NULL;
+	CURL *curl = NULL;
+	curl_socket_t socket = CURL_SOCKET_BAD;
+	char errorBuffer[CURL_ERROR_SIZE] = { 0 };
+};
+
+static size_t getSegmentData(char *data, size_t size, size_t nmemb, DownloadSegment *segment)
+{
+	size_t len = size * nmemb;
+
+	// A server answering 200 ignored our range (or If-Range): don't write the whole package at this offset
+	long httpCode = 0;
+	curl_easy_getinfo(segment->curl, CURLINFO_RESPONSE_CODE, &httpCode);
+	if (httpCode != 206 || segment->offset + static_cast<int64_t>(len) > segment->end + 1)
+		return 0;
+
+	if (!segment->writer->write(data, len, segment->offset))
+		return 0;
+
+	// Only the range at the end of the hash can be hashed now, the others are read back later
+	if (segment->hash && segment->hash->getLength() == static_cast<uint64_t>(segment->offset))
+	{
+		auto start = chrono::steady_clock::now();
+		segment->hash->update(data, len);
+		segment->stats->verifyTime += secondsSince(start);
+	}
+
+	// A complete range is on disk right away, it may have to be read back to be hashed
+	segment->offset += len;
+	if (segment->offset == segment->end + 1 && !segment->writer->flush())
+		return 0;
+	return len;
+}
+
+// End of the part received without hole
+static int64_t getContiguousEnd(const vector<DownloadSegment> & segments)
+{
+	int64_t end = segments.front().start;
+	for (const DownloadSegment & segment : segments)
+	{
+		end = segment.offset;
+		if (segment.offset != segment.end + 1)
+			break;
+	}
+	return end;
+}
+
+// Hash what has been written between the end of the hash and the given offset
+static bool hashFileUpTo(OutputFile & file, Sha256 & hash, int64_t end)
+{
+	int64_t offset = static_cast<int64_t>(hash.getLength());
+	if (offset >= end)
+		return true;
+
+	vector<char> buffer(1024 * 1024);
+	while (offset < end)
+	{
+		size_t len = static_cast<size_t>(min<int64_t>(end - offset, buffer.size()));
+		if (!file.readAt(buffer.data(), len, offset))
+			return false;
+
+		hash.update(buffer.data(), len);
+		offset += len;
+	}
+	return true;
+}
+
+static curl_slist * makeIfRangeHeader(const GupPartialDownload & partial)
+{
+	string ifRange = partial.getIfRange();
+	if (ifRange.empty())
+		return NULL;
+
+	return curl_slist_append(NULL, ("If-Range: " + ifRange).c_str());
+}
+
+GupEngine::GupEngine(const GupParameters & gupParams, const GupExtraOptions & extraOptions) : _gupParams(gupParams), _extraOptions(extraOptions), _session(make_shared<GupSession>())
+{
+	_segmentCount = extraOptions.getSegmentCount();
+	_cacheDir = extraOptions.getCacheDir();
+	_isInfoCacheEnabled = extraOptions.isInfoCacheEnabled();
+	_isDeltaEnabled = extraOptions.isDeltaEnabled();
+	_minSpeed = extraOptions.getMinSpeed();
+	_minSpeedTime = extraOptions.getMinSpeedTime();
+	_bandwidth.setPolicy(extraOptions.getMaxRate(), extraOptions.isBackground());
+	_checkTimeout = extraOptions.getCheckTimeout();
+	_checkConnectTimeout = extraOptions.getCheckConnectTimeout();
+	_isLowPriority = extraOptions.isLowPriority();
+	_prefetchMode = extraOptions.isPrefetchEnabled() ? gupPrefetchWhileAsking : gupPrefetchOff;
+	_isBinaryManifestEnabled = extraOptions.isBinaryManifestEnabled();
+	_logPath = extraOptions.getLogPath();
+
+	const char *tmpDir = getenv("TEMP");
+#ifndef _WIN32
+	if (!tmpDir)
+		tmpDir = getenv("TMPDIR");
+	if (!tmpDir)
+		tmpDir = "/tmp";
+#endif
+	if (tmpDir)
+		_downloadDir = tmpDir;
+}
+
+void GupEngine::makeUserAgent()
+{
+	string winGupUserAgent = "WinGup/";
+	winGupUserAgent += VERSION_VALUE;
+
+	string ua = _gupParams.getSoftwareName();
+	if (ua != "")
+	{
+		ua += "/";
+		ua += _gupParams.getCurrentVersion();
+		ua += " (";
+		ua += winGupUserAgent;
+		ua += ")";
+
+		_userAgent = ua;
+	}
+	else
+	{
+		_userAgent = winGupUserAgent;
+	}
+}
+
+void GupEngine::setCommonOptions(void *curl, char *errorBuffer) const
+{
+	curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(curl, CURLOPT_USERAGENT, _userAgent.c_str());
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
+
+	if (_extraOptions.hasProxySettings())
+	{
+		curl_easy_setopt(curl, CURLOPT_PROXY, _extraOptions.getProxyServer().c_str());
+		curl_easy_setopt(curl, CURLOPT_PROXYPORT, _extraOptions.getPort());
+	}
+
+	curl_easy_setopt(curl, CURLOPT_SSL_OPTIONS, CURLSSLOPT_ALLOW_BEAST | CURLSSLOPT_NO_REVOKE);
+
+	// HTTP/2 whenever the server speaks it (ALPN), on the connections of the whole run
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+	if (_session->share)
+		curl_easy_setopt(curl, CURLOPT_SHARE, _session->share);
+}
+
+void GupEngine::setSpeedFloor(void *curl, int connectionCount) const
+{
+	// The floor is the one of the whole download: each connection of a segmented download has its share.
+	// A download slowed down on purpose (background mode, under its cap) isn't a slow mirror.
+	if (_isSpeedFloorOn && !_bandwidth.isAdaptive())
+	{
+		long minSpeed = _minSpeed;
+		if (_bandwidth.getMaxRate() > 0)
+			minSpeed = static_cast<long>(min<int64_t>(minSpeed, _bandwidth.getMaxRate() / 2));
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, max(minSpeed / connectionCount, 1L));
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, _minSpeedTime);
+	}
+}
+
+long GupEngine::scheduleTransfers(const vector<void *> & handles, int64_t received, int64_t rttUs, GupEngineCallbacks & callbacks)
+{
+	auto now = chrono::steady_clock::now();
+	bool isPaused = callbacks.isPaused();
+	if (isPaused != _isPaused)
+	{
+		_isPaused = isPaused;
+		if (isPaused)
+		{
+			_pausedSince = now;
+		}
+		else
+		{
+			_stats.pausedTime += secondsSince(_pausedSince);
+			_bandwidth.resume(received);
+		}
+	}
+
+	long delay = 0;
+	if (!_isPaused && _bandwidth.isActive())
+	{
+		_bandwidth.update(now, received, rttUs);
+		delay = _bandwidth.getDelay(now, received);
+	}
+
+	// curl keeps the connections while they're paused, the server stops sending once their receive window is full
+	bool isHeld = _isPaused || delay > 0;
+	if (isHeld != _isHeld)
+	{
+		for (void *curl : handles)
+			curl_easy_pause(curl, isHeld ? CURLPAUSE_RECV : CURLPAUSE_CONT);
+		_isHeld = isHeld;
+	}
+
+	return delay > 0 ? min(delay, TRANSFER_POLL_TIMEOUT) : TRANSFER_POLL_TIMEOUT;
+}
+
+void GupEngine::endTransfers()
+{
+	if (_isPaused)
+		_stats.pausedTime += secondsSince(_pausedSince);
+	_isPaused = false;
+	_isHeld = false;
+}
+
+int GupEngine::performDownload(void *curl, const void *socket, GupEngineCallbacks & callbacks)
+{
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return CURLE_OUT_OF_MEMORY;
+
+	_bandwidth.start(0);
+	_isPaused = false;
+	_isHeld = false;
+
+	curl_multi_add_handle(multi, curl);
+	vector<void *> handles(1, curl);
+	CURLcode res = CURLE_FAILED_INIT;
+	for (;;)
+	{
+		int running = 0;
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+			break;
+
+		CURLMsg *msg = NULL;
+		int msgsLeft = 0;
+		bool isDone = false;
+		while ((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL)
+		{
+			if (msg->msg == CURLMSG_DONE)
+			{
+				res = msg->data.result;
+				isDone = true;
+			}
+		}
+		if (isDone || !running)
+			break;
+
+		curl_off_t received = 0;
+		curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+		long timeout = scheduleTransfers(handles, received, getRoundTripTime(*static_cast<const curl_socket_t *>(socket)), callbacks);
+		curl_multi_poll(multi, NULL, 0, static_cast<int>(timeout), NULL);
+	}
+	endTransfers();
+
+	curl_multi_remove_handle(multi, curl);
+	curl_multi_cleanup(multi);
+	return res;
+}
+
+string GupEngine::getInfoUrl() const
+{
+	if (_gupParams.isInfoStatic())
+		return _gupParams.getInfoLocation();
+
+	std::string urlComplete = _gupParams.getInfoLocation() + "?version=";
+	urlComplete += _gupParams.getCurrentVersion();
+
+	if (!_gupParams.getParam().empty())
+	{
+		string customParamPost = "&param=";
+		customParamPost += _gupParams.getParam();
+		urlComplete += customParamPost;
+	}
+	return urlComplete;
+}
+
+// Request to InfoUrl, from the lookup in the cache to the answer (see getUpdateInfo and checkUpdates)
+struct UpdateInfoRequest
+{
+	chrono::steady_clock::time_point start;
+	string url;
+	string cachePath;
+	GupInfoCache infoCache;
+	GupInfoCacheEntry cachedInfo;
+	int64_t now = 0;
+	CURL *curl = NULL;
+	curl_slist *requestHeaders = NULL;
+	ResponseHeaders headers;
+	char errorBuffer[CURL_ERROR_SIZE] = { 0 };
+};
+
+bool GupEngine::getUpdateInfo(string & info2get)
+{
+	UpdateInfoRequest request;
+	if (beginUpdateInfo(request, info2get))
+		return true;
+
+	// What's left of the budget once the cache has been looked up
+	auto deadline = _checkTimeout > 0 ? request.start + chrono::milliseconds(_checkTimeout) : (chrono::steady_clock::time_point::max)();
+	CURLcode res = request.curl ? performUntil(request.curl, deadline) : CURLE_FAILED_INIT;
+	return endUpdateInfo(request, res, info2get);
+}
+
+bool GupEngine::beginUpdateInfo(UpdateInfoRequest & request, string & info2get)
+{
+	request.start = chrono::steady_clock::now();
+	_isCheckOverBudget = false;
+	_isCheckDeferred = false;
+	_retryAfter = 0;
+	_infoSignature.clear();
+	makeUserAgent();
+
+	request.url = getInfoUrl();
+
+	// A fresh answer from a previous run saves the request,
+	// an older one is revalidated with a conditional request
+	request.cachePath = getCachePath(INFOCACHE_FILENAME);
+	if (_isInfoCacheEnabled && !_isStateless && request.infoCache.load(request.cachePath.c_str()) && request.infoCache.find(request.url))
+		request.cachedInfo = *request.infoCache.find(request.url);
+
+	request.now = static_cast<int64_t>(time(NULL));
+	if (!request.cachedInfo.body.empty() && request.cachedInfo.isFresh(request.now))
+	{
+		info2get = request.cachedInfo.body;
+		_infoSignature = request.cachedInfo.signature;
+		_stats.infoCacheResult = gupCacheFresh;
+		_stats.checkTime = secondsSince(request.start);
+		return true;
+	}
+
+	// Check on the web the availibility of update
+	// Get the update package's location
+	CURL *curl = curl_easy_init();
+	request.curl = curl;
+	if (curl)
+	{
+		curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, getUpdateInfoCallback);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &info2get);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, getResponseHeaders);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &request.headers);
+
+		// Whatever compression this curl supports (gzip, deflate, br, zstd), decoded on the fly
+		curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+		if (_isBinaryManifestEnabled)
+			request.requestHeaders = curl_slist_append(request.requestHeaders, MANIFEST_ACCEPT_HEADER);
+
+		const GupInfoCacheEntry & cachedInfo = request.cachedInfo;
+		if (!cachedInfo.body.empty())
+		{
+			if (!cachedInfo.etag.empty())
+				request.requestHeaders = curl_slist_append(request.requestHeaders, ("If-None-Match: " + cachedInfo.etag).c_str());
+			if (!cachedInfo.lastModified.empty())
+				request.requestHeaders = curl_slist_append(request.requestHeaders, ("If-Modified-Since: " + cachedInfo.lastModified).c_str());
+		}
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, request.requestHeaders);
+
+		setCommonOptions(curl, request.errorBuffer);
+		if (_checkConnectTimeout > 0)
+			curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, _checkConnectTimeout);
+	}
+	return false;
+}
+
+bool GupEngine::endUpdateInfo(UpdateInfoRequest & request, int result, string & info2get)
+{
+	CURLcode res = static_cast<CURLcode>(result);
+	long httpCode = 0;
+	_stats.checkError = res;
+	if (request.curl)
+	{
+		curl_easy_getinfo(request.curl, CURLINFO_RESPONSE_CODE, &httpCode);
+		_stats.checkHttpCode = httpCode;
+		curl_off_t checkBytes = 0;
+		if (curl_easy_getinfo(request.curl, CURLINFO_SIZE_DOWNLOAD_T, &checkBytes) == CURLE_OK)
+			_stats.checkBytes = checkBytes;
+		getTransferTimes(request.curl, _stats.checkTimes);
+		curl_easy_cleanup(request.curl);
+		request.curl = NULL;
+	}
+	curl_slist_free_all(request.requestHeaders);
+	request.requestHeaders = NULL;
+
+	if (res != CURLE_OK)
+	{
+		_stats.checkTime = secondsSince(request.start);
+		_isCheckOverBudget = res == CURLE_OPERATION_TIMEDOUT;
+		_lastError = request.errorBuffer[0] ? request.errorBuffer : curl_easy_strerror(res);
+		return false;
+	}
+
+	// An overloaded server tells when to come back, what we have in the cache stays as it is
+	const ResponseHeaders & headers = request.headers;
+	_retryAfter = headers.retryAfter;
+	if ((httpCode == 429 || httpCode == 503) && headers.retryAfter > 0)
+	{
+		_stats.checkTime = secondsSince(request.start);
+		_isCheckDeferred = true;
+		_lastError = "The update server is busy, it asked to check again later.";
+		return false;
+	}
+
+	_infoSignature = headers.signature;
+	if (_isInfoCacheEnabled && !_isStateless)
+	{
+		GupInfoCacheEntry & cachedInfo = request.cachedInfo;
+		if (httpCode == 304 && !cachedInfo.body.empty())
+		{
+			// Not modified: the answer we have is good for another max-age
+			info2get = cachedInfo.body;
+			if (!headers.etag.empty())
+				cachedInfo.etag = headers.etag;
+			if (!headers.signature.empty())
+				cachedInfo.signature = headers.signature;
+			_infoSignature = cachedInfo.signature;
+			_stats.infoCacheResult = gupCacheRevalidated;
+		}
+		else
+		{
+			cachedInfo = GupInfoCacheEntry();
+			cachedInfo.url = request.url;
+			cachedInfo.body = info2get;
+			cachedInfo.etag = headers.etag;
+			cachedInfo.lastModified = headers.lastModified;
+			cachedInfo.signature = headers.signature;
+			_stats.infoCacheResult = gupCacheMiss;
+		}
+
+		cachedInfo.fetchedAt = request.now;
+		if (headers.maxAge >= 0 || httpCode != 304)
+			cachedInfo.maxAge = headers.maxAge > 0 ? headers.maxAge : 0;
+
+		if (httpCode / 100 != 2 && httpCode != 304)
+			request.infoCache.remove(request.url);
+		else if (headers.noStore)
+			request.infoCache.remove(request.url);
+		else
+			request.infoCache.put(cachedInfo);
+		request.infoCache.save(request.cachePath.c_str());
+	}
+
+	_stats.checkTime = secondsSince(request.start);
+	return true;
+}
+
+void GupEngine::checkUpdates(const vector<GupEngine *> & engines)
+{
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return;
+
+	// One connection per host: HTTP/2 multiplexes the requests on it, HTTP/1.1 sends them one after the other.
+	// Either way, a single TLS handshake for all the products of the same update server
+	curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, 1L);
+
+	vector<unique_ptr<UpdateInfoRequest>> requests(engines.size());
+	for (size_t i = 0; i < engines.size(); ++i)
+	{
+		GupEngine & engine = *engines[i];
+		engine._isInfoChecked = false;
+		engine._checkedInfo.clear();
+		// The connections of the check are then the ones of the downloads of all the products
+		engine._session = engines.front()->_session;
+
+		// run() tells this product has to wait
+		GupCheckSchedule schedule;
+		engine.loadSchedule(schedule);
+		if (engine.getNextCheckIn(schedule) > 0)
+			continue;
+
+		requests[i].reset(new UpdateInfoRequest);
+		if (!engine.beginCheck(*requests[i]))
+		{
+			requests[i].reset();
+			continue;
+		}
+
+		curl_easy_setopt(requests[i]->curl, CURLOPT_PIPEWAIT, 1L);
+		curl_multi_add_handle(multi, requests[i]->curl);
+	}
+
+	int running = 1;
+	while (running)
+	{
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+			break;
+
+		CURLMsg *msg = NULL;
+		int msgsLeft = 0;
+		while ((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL)
+		{
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			for (size_t i = 0; i < requests.size(); ++i)
+			{
+				if (requests[i] && requests[i]->curl == msg->easy_handle)
+				{
+					curl_multi_remove_handle(multi, msg->easy_handle);
+					engines[i]->_isInfoCheckOk = engines[i]->endUpdateInfo(*requests[i], msg->data.result, engines[i]->_checkedInfo);
+					requests[i].reset();
+					break;
+				}
+			}
+		}
+
+		if (running)
+			curl_multi_poll(multi, NULL, 0, 1000, NULL);
+	}
+
+	// The multi handle failed: so did the requests still running
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		if (requests[i])
+		{
+			curl_multi_remove_handle(multi, requests[i]->curl);
+			engines[i]->_isInfoCheckOk = engines[i]->endUpdateInfo(*requests[i], CURLE_FAILED_INIT, engines[i]->_checkedInfo);
+		}
+	}
+	curl_multi_cleanup(multi);
+}
+
+void GupEngine::simulateFleet(const vector<GupEngine *> & engines, int concurrency, double checksPerSecond)
+{
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+		return;
+
+	// No limit per host here: the connections of each engine are its own, as for separate machines (see GupSession).
+	// The handle of each check points to its request, thousands of them are no list to search
+	vector<unique_ptr<UpdateInfoRequest>> requests(engines.size());
+	auto start = chrono::steady_clock::now();
+	size_t next = 0;
+	int inFlight = 0;
+	while (next < engines.size() || inFlight > 0)
+	{
+		// Start what the concurrency and the rate allow
+		while (next < engines.size() && inFlight < concurrency)
+		{
+			if (checksPerSecond > 0 && chrono::steady_clock::now() < start + chrono::duration<double>(next / checksPerSecond))
+				break;
+
+			GupEngine & engine = *engines[next];
+			engine._isInfoChecked = false;
+			engine._checkedInfo.clear();
+			requests[next].reset(new UpdateInfoRequest);
+			UpdateInfoRequest & request = *requests[next];
+			if (engine.beginCheck(request))
+			{
+				curl_easy_setopt(request.curl, CURLOPT_PRIVATE, &requests[next]);
+				curl_multi_add_handle(multi, request.curl);
+				++inFlight;
+			}
+			else
+			{
+				requests[next].reset();
+			}
+			++next;
+		}
+
+		int running = 0;
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+			break;
+
+		CURLMsg *msg = NULL;
+		int msgsLeft = 0;
+		while ((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL)
+		{
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+
+			unique_ptr<UpdateInfoRequest> *request = NULL;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &request);
+			GupEngine & engine = *engines[request - requests.data()];
+			curl_multi_remove_handle(multi, msg->easy_handle);
+			engine._isInfoCheckOk = engine.endUpdateInfo(**request, msg->data.result, engine._checkedInfo);
+			request->reset();
+			--inFlight;
+		}
+
+		// Until one of the checks in flight needs curl, or the next one is due
+		long long timeout = 1000;
+		if (next < engines.size() && inFlight < concurrency)
+		{
+			auto due = start + chrono::duration<double>(checksPerSecond > 0 ? next / checksPerSecond : 0);
+			timeout = min(timeout, max<long long>(0, chrono::duration_cast<chrono::milliseconds>(due - chrono::steady_clock::now()).count()));
+		}
+		if (timeout > 0 && (inFlight > 0 || next < engines.size()))
+			curl_multi_poll(multi, NULL, 0, static_cast<int>(timeout), NULL);
+	}
+
+	// The multi handle failed: so did the requests still running
+	for (size_t i = 0; i < requests.size(); ++i)
+	{
+		if (requests[i])
+		{
+			curl_multi_remove_handle(multi, requests[i]->curl);
+			engines[i]->_isInfoCheckOk = engines[i]->endUpdateInfo(*requests[i], CURLE_FAILED_INIT, engines[i]->_checkedInfo);
+		}
+	}
+	curl_multi_cleanup(multi);
+}
+
+bool GupEngine::beginCheck(UpdateInfoRequest & request)
+{
+	if (_isLowPriority)
+		enterBackgroundMode();
+
+	_isInfoChecked = true;
+	if (beginUpdateInfo(request, _checkedInfo))
+	{
+		_isInfoCheckOk = true;
+		return false;
+	}
+	if (!request.curl)
+	{
+		_isInfoCheckOk = endUpdateInfo(request, CURLE_FAILED_INIT, _checkedInfo);
+		return false;
+	}
+
+	if (_checkTimeout > 0)
+		curl_easy_setopt(request.curl, CURLOPT_TIMEOUT_MS, _checkTimeout);
+	return true;
+}
+
+void GupEngine::loadSchedule(GupCheckSchedule & schedule) const
+{
+	if (!_isStateless)
+		schedule.load(getCachePath(SCHEDULE_FILENAME).c_str());
+}
+
+void GupEngine::saveSchedule(const GupCheckSchedule & schedule) const
+{
+	if (!_isStateless)
+		schedule.save(getCachePath(SCHEDULE_FILENAME).c_str());
+}
+
+string GupEngine::getCachePath(const char *fileName) const
+{
+	string path = _cacheDir.empty() ? _downloadDir : _cacheDir;
+	if (!path.empty() && path.back() != PATH_SEPARATOR)
+		path += PATH_SEPARATOR;
+	return path + fileName;
+}
+
+// Short request racing the other mirrors of the package
+struct MirrorProbe
+{
+	const GupMirror *mirror = NULL;
+	CURL *curl = NULL;
+	double time = -1;  // seconds to answer divided by the weight, -1 without answer
+};
+
+vector<string> GupEngine::rankMirrors(const vector<GupMirror> & mirrors)
+{
+	auto start = chrono::steady_clock::now();
+	if (_userAgent.empty())
+		makeUserAgent();
+
+	// A HEAD request to each of them at once, on one multi handle
+	vector<MirrorProbe> probes(mirrors.size());
+	char errorBuffer[CURL_ERROR_SIZE] = { 0 };
+	CURLM *multi = mirrors.size() > 1 ? curl_multi_init() : NULL;
+	for (size_t i = 0; i < mirrors.size(); ++i)
+	{
+		MirrorProbe & probe = probes[i];
+		probe.mirror = &mirrors[i];
+		if (!multi || mirrors[i].weight == 0)
+			continue;
+
+		probe.curl = curl_easy_init();
+		if (!probe.curl)
+			continue;
+
+		curl_easy_setopt(probe.curl, CURLOPT_URL, mirrors[i].location.c_str());
+		curl_easy_setopt(probe.curl, CURLOPT_NOBODY, 1L);
+		curl_easy_setopt(probe.curl, CURLOPT_FAILONERROR, 1L);
+		curl_easy_setopt(probe.curl, CURLOPT_PRIVATE, &probe);
+		setCommonOptions(probe.curl, errorBuffer);
+		curl_multi_add_handle(multi, probe.curl);
+	}
+
+	// Once the fastest has answered, the others have as long again:
+	// a mirror more than twice slower isn't worth waiting for
+	auto deadline = start + chrono::milliseconds(MIRROR_PROBE_TIMEOUT);
+	bool hasAnswer = false;
+	int running = multi ? 1 : 0;
+	while (running)
+	{
+		if (curl_multi_perform(multi, &running) != CURLM_OK)
+			break;
+
+		CURLMsg *msg = NULL;
+		int msgsLeft = 0;
+		while ((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL)
+		{
+			if (msg->msg != CURLMSG_DONE || msg->data.result != CURLE_OK)
+				continue;
+
+			MirrorProbe *probe = NULL;
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &probe);
+			probe->time = getTime(msg->easy_handle, CURLINFO_TOTAL_TIME_T) / probe->mirror->weight;
+			if (!hasAnswer)
+			{
+				hasAnswer = true;
+				auto now = chrono::steady_clock::now();
+				deadline = min(deadline, now + (now - start));
+			}
+		}
+
+		auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+		if (left <= 0)
+			break;
+		if (running)
+			curl_multi_poll(multi, NULL, 0, static_cast<int>(min<long long>(left, 100)), NULL);
+	}
+
+	for (MirrorProbe & probe : probes)
+	{
+		if (!probe.curl)
+			continue;
+
+		curl_multi_remove_handle(multi, probe.curl);
+		curl_easy_cleanup(probe.curl);
+	}
+	if (multi)
+		curl_multi_cleanup(multi);
+
+	// The ones which didn't answer are still tried last, by weight: HEAD may just not be allowed there
+	stable_sort(probes.begin(), probes.end(), [](const MirrorProbe & a, const MirrorProbe & b) {
+		if ((a.time >= 0) != (b.time >= 0))
+			return a.time >= 0;
+		if (a.time >= 0)
+			return a.time < b.time;
+		return a.mirror->weight > b.mirror->weight;
+	});
+
+	vector<string> ranked;
+	for (const MirrorProbe & probe : probes)
+		ranked.push_back(probe.mirror->location);
+
+	_stats.mirrorProbeTime = secondsSince(start);
+	return ranked;
+}
+
+bool GupEngine::downloadBinary(const string & urlFrom, const string & destTo, GupEngineCallbacks & callbacks, const string & sha256)
+{
+	return downloadBinary(vector<string>(1, urlFrom), destTo, callbacks, sha256);
+}
+
+bool GupEngine::downloadBinary(const vector<string> & mirrors, const string & destTo, GupEngineCallbacks & callbacks, const string & sha256)
+{
+	auto start = chrono::steady_clock::now();
+	_isAborted = false;
+	_isCorrupted = false;
+	_isHashing = !sha256.empty();
+	_stats.downloadIp.clear();
+	_stats.downloadTimes = GupTransferTimes();
+	_stats.downloadedBytes = 0;
+	_stats.mirrorFailovers = 0;
+	if (_userAgent.empty())
+		makeUserAgent();
+
+	// The package is received in <package>.part and only renamed once complete.
+	// If the previous run was interrupted, its state tells from where to resume, whatever the mirror it was on.
+	string partPath = destTo + ".part";
+	string statePath = partPath + ".xml";
+
+	GupPartialDownload previous;
+	if (!previous.load(statePath.c_str()) || find(mirrors.begin(), mirrors.end(), previous.getUrl()) == mirrors.end() ||
+		!previous.canResume() || OutputFile::getSize(partPath) < previous.getReceived())
+	{
+		previous = GupPartialDownload();
+	}
+
+	callbacks.onDownloadStart(destTo);
+
+	bool isOk = false;
+	for (size_t i = 0; i < mirrors.size() && !isOk && !_isAborted; ++i)
+	{
+		if (i > 0)
+		{
+			// The next mirror continues from what the previous one has sent, or starts over if its package was wrong
+			++_stats.mirrorFailovers;
+			previous = _partial.canResume() ? _partial : GupPartialDownload();
+		}
+
+		// Slow is better than nothing: the last mirror has no speed floor
+		_isCorrupted = false;
+		_isSpeedFloorOn = _minSpeed > 0 && i + 1 < mirrors.size();
+		isOk = downloadFromMirror(mirrors[i], partPath, previous, callbacks);
+
+		if (isOk && _isHashing)
+		{
+			// Never run a package which isn't the one announced: drop it, another mirror or a next run will download it again
+			bool isComplete = static_cast<int64_t>(_packageHash.getLength()) == OutputFile::getSize(partPath);
+			auto verifyStart = chrono::steady_clock::now();
+			string digest = _packageHash.finish();
+			_stats.verifyTime += secondsSince(verifyStart);
+			if (!isComplete || digest != sha256)
+			{
+				_lastError = "The SHA-256 of " + partPath + " doesn't match the one of the update info.";
+				_isCorrupted = true;
+				_partial.setReceived(0);
+				isOk = false;
+			}
+		}
+	}
+	_isSpeedFloorOn = false;
+
+	if (isOk)
+	{
+		remove(destTo.c_str());
+		if (rename(partPath.c_str(), destTo.c_str()) != 0)
+		{
+			_lastError = "Cannot rename " + partPath + " to " + destTo + ".";
+			isOk = false;
+		}
+		remove(statePath.c_str());
+	}
+	else if (_partial.canResume())
+	{
+		// Keep what we've got for the next run
+		_partial.save(statePath.c_str());
+	}
+	else
+	{
+		remove(partPath.c_str());
+		remove(statePath.c_str());
+	}
+
+	_stats.downloadTime = secondsSince(start);
+	return isOk;
+}
+
+bool GupEngine::downloadFromMirror(const string & urlFrom, const string & destTo, GupPartialDownload previous, GupEngineCallbacks & callbacks)
+{
+	_stats.downloadUrl = urlFrom;
+	_isTooSlow = false;
+	_partial = GupPartialDownload();
+	_partial.setUrl(urlFrom);
+
+	// What another mirror has sent has other validators: only its hash can tell it's the same package
+	bool isVerifiedResume = _isHashing && previous.getUrl() != urlFrom;
+
+	bool isOk = false;
+	int64_t fileSize = 0;
+	string rangeUrl;
+	ResponseHeaders headers;
+	if (_segmentCount > 1 && !isPackageSource(urlFrom) && probeRanges(urlFrom, fileSize, rangeUrl, headers))
+	{
+		_partial.setValidators(headers.etag, headers.lastModified);
+		_partial.setSize(fileSize);
+
+		// Resume only if the package on the server is still the one we've partially got
+		int64_t resumeFrom = 0;
+		if (previous.canResume() && previous.getSize() == fileSize &&
+			((!headers.etag.empty() && headers.etag == previous.getETag()) ||
+			 (headers.etag.empty() && !headers.lastModified.empty() && headers.lastModified == previous.getLastModified()) ||
+			 isVerifiedResume))
+		{
+			resumeFrom = previous.getReceived();
+			_partial.setHashState(previous.getHashState());
+		}
+
+		// Small packages are not worth extra connections
+		int64_t maxSegments = (fileSize - resumeFrom) / MIN_SEGMENT_SIZE;
+		int segmentCount = maxSegments < _segmentCount ? static_cast<int>(maxSegments) : _segmentCount;
+		if (segmentCount > 1)
+		{
+			// The file has been truncated to what it holds now: the old state is no longer valid
+			isOk = downloadSegments(rangeUrl, destTo, fileSize, resumeFrom, segmentCount, callbacks);
+			if (!isOk && !_isAborted)
+				previous = _partial.canResume() ? _partial : GupPartialDownload();
+		}
+	}
+
+	// The single stream is also the fallback of a segmented download which didn't work out,
+	// unless this mirror is too slow: the next one will do better
+	if (!isOk && !_isAborted && !_isTooSlow)
+		isOk = downloadSingleStream(urlFrom, destTo, previous, callbacks);
+
+	return isOk;
+}
+
+bool GupEngine::isPackageSource(const string & url) const
+{
+	for (const GupPackageSource & source : _extraOptions.getPackageSources())
+	{
+		if (url.compare(0, source.location.size(), source.location) == 0)
+			return true;
+	}
+	return false;
+}
+
+// Last component of the path of an url
+static string getFileName(const string & location)
+{
+	string fileName = location.substr(0, location.find_first_of("?#"));
+	string::size_type lastSlash = fileName.find_last_of('/');
+	if (lastSlash != string::npos)
+		fileName = fileName.substr(lastSlash + 1);
+	return fileName;
+}
+
+static size_t readPackageData(char *data, size_t size, size_t nmemb, FILE *package)
+{
+	return fread(data, size, nmemb, package);
+}
+
+static int getPublishProgress(void *clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+	return static_cast<GupEngineCallbacks *>(clientp)->isPublishStopped() ? 1 : 0;
+}
+
+// Path of the file of a file:// URL, empty for the other protocols
+static string getFileUrlPath(CURL *curl, const string & url)
+{
+	const char FILE_SCHEME[] = "file://";
+	const size_t FILE_SCHEME_SIZE = sizeof(FILE_SCHEME) - 1;
+	if (url.compare(0, FILE_SCHEME_SIZE, FILE_SCHEME) != 0)
+		return "";
+
+	char *unescaped = curl_easy_unescape(curl, url.c_str() + FILE_SCHEME_SIZE, 0, NULL);
+	if (!unescaped)
+		return "";
+	string path = unescaped;
+	curl_free(unescaped);
+
+	if (path.compare(0, 9, "localhost") == 0)
+		path.erase(0, 9);
+#ifdef _WIN32
+	// file:///C:/updates/ is C:/updates/, file:////fileserver/updates/ the share //fileserver/updates/
+	if (path.size() > 2 && path[0] == '/' && path[2] == ':')
+		path.erase(0, 1);
+#endif
+	return path;
+}
+
+void GupEngine::publishPackage(const GupDownloadInfo & gupDlInfo, const string & packagePath, GupEngineCallbacks & callbacks)
+{
+	// Only a package downloaded by this run, which the next machines can check with the hash
+	if (_stats.isPackageReady || gupDlInfo.getSha256().empty())
+		return;
+
+	auto start = chrono::steady_clock::now();
+	string packageName = getFileName(gupDlInfo.getDownloadLocation());
+	for (const GupPackageSource & source : _extraOptions.getPackageSources())
+	{
+		// The sources after the one the package comes from are further away
+		if (_stats.downloadUrl.compare(0, source.location.size(), source.location) == 0)
+			break;
+		if (!source.isPublished)
+			continue;
+
+		// Uploaded like downloaded: written to a file:// share, PUT to an http:// cache.
+		// Best effort, and the next machines check what they get from there anyway.
+		// On a share, the package is written under a temporary name and renamed once complete:
+		// the machines reading it meanwhile don't go back to the Internet for a truncated one
+		FILE *package = fopen(packagePath.c_str(), "rb");
+		CURL *curl = package ? curl_easy_init() : NULL;
+		if (curl)
+		{
+			char errorBuffer[CURL_ERROR_SIZE] = { 0 };
+			string url = source.location + packageName;
+			string path = getFileUrlPath(curl, url);
+			string uploadUrl = path.empty() ? url : url + ".part";
+			curl_easy_setopt(curl, CURLOPT_URL, uploadUrl.c_str());
+			curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+			curl_easy_setopt(curl, CURLOPT_READFUNCTION, readPackageData);
+			curl_easy_setopt(curl, CURLOPT_READDATA, package);
+			curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(OutputFile::getSize(packagePath)));
+			curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+			setCommonOptions(curl, errorBuffer);
+			curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, PACKAGE_SOURCE_CONNECT_TIMEOUT);
+			curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, PACKAGE_PUBLISH_TIMEOUT);
+			curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+			curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, getPublishProgress);
+			curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &callbacks);
+
+			bool isUploaded = curl_easy_perform(curl) == CURLE_OK;
+			curl_easy_cleanup(curl);
+
+			if (!path.empty())
+			{
+				string partPath = path + ".part";
+				if (isUploaded)
+				{
+					remove(path.c_str());
+					isUploaded = rename(partPath.c_str(), path.c_str()) == 0;
+				}
+				if (!isUploaded)
+					remove(partPath.c_str());
+			}
+		}
+		if (package)
+			fclose(package);
+	}
+	_stats.publishTime = secondsSince(start);
+}
+
+bool GupEngine::resumeHash(OutputFile & file, const GupPartialDownload & previous, int64_t resumeFrom)
+{
+	// The hash of the received part is saved with the partial download,
+	// without it (or if it doesn't fit) the received part is read again
+	_packageHash.reset();
+	if (!_isHashing || resumeFrom == 0)
+		return true;
+
+	if (_packageHash.loadState(previous.getHashState()) && _packageHash.getLength() == static_cast<uint64_t>(resumeFrom))
+		return true;
+
+	_packageHash.reset();
+	auto start = chrono::steady_clock::now();
+	bool isOk = hashFileUpTo(file, _packageHash, resumeFrom);
+	_stats.verifyTime += secondsSince(start);
+	return isOk;
+}
+
+bool GupEngine::downloadSingleStream(const string & urlFrom, const string & destTo, const GupPartialDownload & previous, GupEngineCallbacks & callbacks)
+{
+	int64_t resumeFrom = previous.canResume() ? previous.getReceived() : 0;
+	// Resumed from another mirror: its validators mean nothing here, the hash of the package checks it
+	bool isVerifiedResume = _isHashing && previous.getUrl() != urlFrom;
+
+	// Drop what has been written after the last saved state
+	OutputFile file;
+	if (!file.open(destTo, resumeFrom > 0) || !file.truncate(resumeFrom))
+	{
+		_lastError = "Cannot open " + destTo + " for writing.";
+		return false;
+	}
+
+	if (!resumeHash(file, previous, resumeFrom))
+	{
+		_lastError = "Cannot read " + destTo + ".";
+		return false;
+	}
+
+	//  Download the install package from indicated location
+	char errorBuffer[CURL_ERROR_SIZE] = { 0 };
+	CURLcode res = CURLE_FAILED_INIT;
+	CURL* curl = curl_easy_init();
+	CoalescingWriter writer(file);
+	StreamDownload download;
+	download.callbacks = &callbacks;
+	download.file = &file;
+	download.writer = &writer;
+	download.curl = curl;
+	download.hash = _isHashing ? &_packageHash : NULL;
+	download.stats = &_stats;
+	download.isPaused = &_isPaused;
+	ResponseHeaders headers;
+	long httpCode = 0;
+
+	if (curl)
+	{
+		curl_easy_setopt(curl, CURLOPT_URL, urlFrom.c_str());
+		curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, getDownloadData);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &download);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, getResponseHeaders);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+
+		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+		curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, getDownloadProgress);
+		curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &download);
+
+		setCommonOptions(curl, errorBuffer);
+		setSpeedFloor(curl, 1);
+		watchSocket(curl, &download.socket);
+		// The background mode measures the RTT on the socket of the download: curl only tells a new one
+		if (_bandwidth.isAdaptive())
+			curl_easy_setopt(curl, CURLOPT_FRESH_CONNECT, 1L);
+		if (isPackageSource(urlFrom))
+			curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, PACKAGE_SOURCE_CONNECT_TIMEOUT);
+
+		for (;;)
+		{
+			// If-Range: the server sends the rest only if the package didn't change, else the whole package
+			download.resumeFrom = resumeFrom;
+			download.offset = resumeFrom;
+			download.isPreallocated = false;
+			curl_slist *ifRange = resumeFrom > 0 && !isVerifiedResume ? makeIfRangeHeader(previous) : NULL;
+			curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, static_cast<curl_off_t>(resumeFrom));
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, ifRange);
+
+			res = static_cast<CURLcode>(performDownload(curl, &download.socket, callbacks));
+
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+			curl_slist_free_all(ifRange);
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
+
+			// 200 instead of 206 (the package changed) or 416 (it's shorter than what we have): start over from byte zero.
+			// Any other error (a 5xx, a 404 of the mirror) says nothing of what we have: it's kept for the next try
+			if (resumeFrom > 0 && (res == CURLE_RANGE_ERROR || (res == CURLE_HTTP_RETURNED_ERROR && httpCode == 416)) && file.truncate(0))
+			{
+				writer.discard();
+				resumeFrom = 0;
+				_packageHash.reset();
+				errorBuffer[0] = '\0';
+				continue;
+			}
+			break;
+		}
+
+		_isTooSlow = _isSpeedFloorOn && res == CURLE_OPERATION_TIMEDOUT;
+		_stats.downloadedBytes += download.offset - resumeFrom;
+		getTransferTimes(curl, _stats.downloadTimes, &_stats.downloadIp);
+		curl_easy_cleanup(curl);
+	}
+
+	// An error answer has no validators of the package: what we had resumed keeps its own
+	if (httpCode / 100 == 2)
+		_partial.setValidators(headers.etag, headers.lastModified);
+	else if (resumeFrom > 0)
+		_partial = previous;
+	_partial.setReceived(download.offset);
+	if (_isHashing)
+		_partial.setHashState(_packageHash.saveState());
+
+	// What's still in the buffer is written now: if it fails, we don't know what the file holds
+	bool isWritten = writer.flush();
+	isWritten = file.close() && isWritten;
+	_stats.writeTime += writer.getWriteTime();
+	if (!isWritten)
+		_partial.setReceived(0);
+
+	if (res == CURLE_OK && !isWritten)
+	{
+		_lastError = "Cannot write " + destTo + ".";
+		return false;
+	}
+	else if (res == CURLE_WRITE_ERROR && !download.writeError.empty())
+	{
+		_lastError = download.writeError + " (" + destTo + ")";
+		return false;
+	}
+	else if (res == CURLE_ABORTED_BY_CALLBACK)
+	{
+		_isAborted = true;
+		return false;
+	}
+	else if (res != CURLE_OK)
+	{
+		_lastError = errorBuffer[0] ? errorBuffer : curl_easy_strerror(res);
+		return false;
+	}
+
+	return true;
+}
+
+bool GupEngine::probeRanges(const string & url, int64_t & fileSize, string & effectiveUrl, ResponseHeaders & headers)
+{
+	char errorBuffer[CURL_ERROR_SIZE] = { 0 };
+	CURL *curl = curl_easy_init();
+	if (!curl)
+		return false;
+
+	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+	curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+	curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, getResponseHeaders);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+	setCommonOptions(curl, errorBuffer);
+
+	curl_off_t contentLength = -1;
+	char *lastUrl = NULL;
+	bool isOk = curl_easy_perform(curl) == CURLE_OK &&
+		curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength) == CURLE_OK &&
+		curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &lastUrl) == CURLE_OK && lastUrl;
+
+	if (isOk)
+	{
+		fileSize = contentLength;
+		// Ask the ranges directly to the final location instead of following the redirections once per range
+		effectiveUrl = lastUrl;
+	}
+
+	curl_easy_cleanup(curl);
+	return isOk && headers.acceptRanges && fileSize > 0;
+}
+
+bool GupEngine::downloadSegments(const string & url, const string & destTo, int64_t fileSize, int64_t resumeFrom, int segmentCount, GupEngineCallbacks & callbacks)
+{
+	OutputFile file;
+	if (!file.open(destTo, resumeFrom > 0) || !file.truncate(resumeFrom))
+	{
+		_lastError = "Cannot open " + destTo + " for writing.";
+		return false;
+	}
+
+	if (!resumeHash(file, _partial, resumeFrom))
+	{
+		_lastError = "Cannot read " + destTo + ".";
+		return false;
+	}
+
+	if (!file.preallocate(fileSize))
+	{
+		_lastError = "Not enough disk space to download " + destTo + ".";
+		return false;
+	}
+
+	CURLM *multi = curl_multi_init();
+	if (!multi)
+	{
+		_lastError = curl_multi_strerror(CURLM_OUT_OF_MEMORY);
+		return false;
+	}
+
+	// Each range is received on its own connection and written at its own offset
+	curl_slist *ifRange = makeIfRangeHeader(_partial);
+	int64_t receivedBefore = _stats.downloadedBytes;
+	vector<DownloadSegment> segments(segmentCount);
+	int64_t segmentSize = (fileSize - resumeFrom) / segmentCount;
+	bool isOk = true;
+	for (int i = 0; i < segmentCount; ++i)
+	{
+		DownloadSegment & segment = segments[i];
+		segment.writer.reset(new CoalescingWriter(file));
+		segment.hash = _isHashing ? &_packageHash : NULL;
+		segment.stats = &_stats;
+		segment.start = resumeFrom + i * segmentSize;
+		segment.offset = segment.start;
+		segment.end = (i == segmentCount - 1) ? fileSize - 1 : segment.start + segmentSize - 1;
+		segment.curl = curl_easy_init();
+		if (!segment.curl)
+		{
+			_lastError = curl_easy_strerror(CURLE_OUT_OF_MEMORY);
+			isOk = false;
+			break;
+		}
+
+		string range = to_string(segment.start) + "-" + to_string(segment.end);
+		curl_easy_setopt(segment.curl, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(segment.curl, CURLOPT_RANGE, range.c_str());
+		curl_easy_setopt(segment.curl, CURLOPT_HTTPHEADER, ifRange);
+		curl_easy_setopt(segment.curl, CURLOPT_FAILONERROR, 1L);
+		curl_easy_setopt(segment.curl, CURLOPT_WRITEFUNCTION, getSegmentData);
+		curl_easy_setopt(segment.curl, CURLOPT_WRITEDATA, &segment);
+		curl_easy_setopt(segment.curl, CURLOPT_PRIVATE, &segment);
+		setCommonOptions(segment.curl, segment.errorBuffer);
+		setSpeedFloor(segment.curl, segmentCount);
+		watchSocket(segment.curl, &segment.socket);
+		if (_bandwidth.isAdaptive())
+			curl_easy_setopt(segment.curl, CURLOPT_FRESH_CONNECT, 1L);
+		// A connection per range: HTTP/2 would multiplex them all on the connection of the check
+		if (segmentCount > 1)
+			curl_easy_setopt(segment.curl, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_1_1));
+
+		curl_multi_add_handle(multi, segment.curl);
+	}
+
+	_bandwidth.start(0);
+	_isPaused = false;
+	_isHeld = false;
+	vector<void *> handles;
+	int running = isOk ? 1 : 0;
+	while (running)
+	{
+		CURLMcode mc = curl_multi_perform(multi, &running);
+		if (mc != CURLM_OK)
+		{
+			_lastError = curl_multi_strerror(mc);
+			isOk = false;
+			break;
+		}
+
+		CURLMsg *msg = NULL;
+		int msgsLeft = 0;
+		while ((msg = curl_multi_info_read(multi, &msgsLeft)) != NULL)
+		{
+			if (msg->msg == CURLMSG_DONE && msg->data.result != CURLE_OK && isOk)
+			{
+				DownloadSegment *segment = NULL;
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &segment);
+				_lastError = segment->errorBuffer[0] ? segment->errorBuffer : curl_easy_strerror(msg->data.result);
+				_isTooSlow = _isSpeedFloorOn && msg->data.result == CURLE_OPERATION_TIMEDOUT;
+				isOk = false;
+			}
+		}
+		if (!isOk)
+			break;
+
+		// One progress for all the ranges
+		int64_t received = 0;
+		for (const DownloadSegment & segment : segments)
+			received += segment.offset - segment.start;
+
+		_stats.downloadedBytes = receivedBefore + received;
+		if (!_isPaused && !callbacks.onProgress(fileSize, resumeFrom + received))
+		{
+			_isAborted = true;
+			isOk = false;
+			break;
+		}
+
+		// A range received before the one preceding it is hashed once that one is complete,
+		// while it's still in the system cache
+		int64_t contiguousEnd = getContiguousEnd(segments);
+		if (_isHashing && static_cast<int64_t>(_packageHash.getLength()) < contiguousEnd)
+		{
+			for (DownloadSegment & segment : segments)
+			{
+				if (segment.start < contiguousEnd && segment.offset > static_cast<int64_t>(_packageHash.getLength()))
+					isOk = segment.writer->flush() && isOk;
+			}
+
+			auto verifyStart = chrono::steady_clock::now();
+			isOk = isOk && hashFileUpTo(file, _packageHash, contiguousEnd);
+			_stats.verifyTime += secondsSince(verifyStart);
+			if (!isOk)
+			{
+				_lastError = "Cannot read " + destTo + ".";
+				isOk = false;
+				break;
+			}
+		}
+
+		// The bandwidth is shared by the ranges still being received, any of them tells how busy the link is
+		handles.clear();
+		int64_t rtt = -1;
+		for (DownloadSegment & segment : segments)
+		{
+			if (segment.offset <= segment.end)
+			{
+				handles.push_back(segment.curl);
+				if (rtt < 0)
+					rtt = getRoundTripTime(segment.socket);
+			}
+		}
+		long timeout = scheduleTransfers(handles, received, rtt, callbacks);
+
+		if (running)
+			curl_multi_poll(multi, NULL, 0, static_cast<int>(timeout), NULL);
+	}
+	endTransfers();
+
+	if (segments.front().curl)
+		getTransferTimes(segments.front().curl, _stats.downloadTimes, &_stats.downloadIp);
+
+	for (DownloadSegment & segment : segments)
+	{
+		if (!segment.curl)
+			continue;
+
+		curl_multi_remove_handle(multi, segment.curl);
+		curl_easy_cleanup(segment.curl);
+	}
+	curl_multi_cleanup(multi);
+	curl_slist_free_all(ifRange);
+
+	// Only the part received without hole can be resumed, once it's on disk
+	bool isWritten = true;
+	for (DownloadSegment & segment : segments)
+	{
+		if (segment.writer)
+		{
+			isWritten = segment.writer->flush() && isWritten;
+			_stats.writeTime += segment.writer->getWriteTime();
+		}
+	}
+
+	int64_t received = isWritten ? getContiguousEnd(segments) : 0;
+	if (isOk && !isWritten)
+	{
+		_lastError = "Cannot write " + destTo + ".";
+		isOk = false;
+	}
+	else if (isOk && received != fileSize)
+	{
+		_lastError = "The download of " + destTo + " is incomplete.";
+		isOk = false;
+	}
+
+	_partial.setReceived(received);
+	auto verifyStart = chrono::steady_clock::now();
+	bool isHashed = !_isHashing || hashFileUpTo(file, _packageHash, received);
+	_stats.verifyTime += secondsSince(verifyStart);
+	if (_isHashing)
+	{
+		if (isHashed)
+		{
+			_partial.setHashState(_packageHash.saveState());
+		}
+		else if (isOk)
+		{
+			_lastError = "Cannot read " + destTo + ".";
+			isOk = false;
+		}
+	}
+	if (!file.close())
+	{
+		_partial.setReceived(0);
+		if (isOk)
+		{
+			_lastError = "Cannot write " + destTo + ".";
+			isOk = false;
+		}
+	}
+
+	return isOk;
+}
+
+bool GupEngine::downloadDelta(const GupDelta & delta, const string & destTo, GupEngineCallbacks & callbacks, const string & sha256)
+{
+	// The base is the package of the current version, still where it was downloaded the last time
+	string basePath = getPackagePath(delta.base);
+	int64_t baseSize = OutputFile::getSize(basePath);
+	if (baseSize < 0)
+		return false;
+
+	// The delta is downloaded like a package (resumed if it's interrupted...), then applied
+	string deltaPath = destTo + ".gupdiff";
+	if (!downloadBinary(delta.location, deltaPath, callbacks, delta.sha256))
+		return false;
+
+	auto start = chrono::steady_clock::now();
+	bool isOk = applyDelta(basePath, baseSize, deltaPath, destTo, sha256);
+	remove(deltaPath.c_str());
+
+	_stats.isDeltaApplied = isOk;
+	_stats.patchTime = secondsSince(start);
+	return isOk;
+}
+
+bool GupEngine::applyDelta(const string & basePath, int64_t baseSize, const string & deltaPath, const string & destTo, const string & sha256)
+{
+	string partPath = destTo + ".part";
+	OutputFile base, deltaFile, target;
+	if (!base.openForReading(basePath) || !deltaFile.openForReading(deltaPath))
+	{
+		_lastError = "Cannot read " + basePath + " or " + deltaPath + ".";
+		return false;
+	}
+	if (!target.open(partPath))
+	{
+		_lastError = "Cannot open " + partPath + " for writing.";
+		return false;
+	}
+
+	// The base may be the file we're about to replace (same name for all the versions): it's only renamed at the end
+	PatchApplier patcher(base, baseSize, target);
+	int64_t deltaSize = OutputFile::getSize(deltaPath);
+	vector<char> buffer(256 * 1024);
+	bool isOk = true;
+	for (int64_t offset = 0; isOk && offset < deltaSize; )
+	{
+		size_t len = static_cast<size_t>(min<int64_t>(deltaSize - offset, buffer.size()));
+		isOk = deltaFile.readAt(buffer.data(), len, offset) && patcher.feed(buffer.data(), len);
+		offset += len;
+	}
+
+	if (!isOk || !patcher.isComplete())
+	{
+		_lastError = patcher.getError().empty() ? "The delta " + deltaPath + " is incomplete." : patcher.getError();
+		isOk = false;
+	}
+	else
+	{
+		// The delta tells what it rebuilds, the update info too: both have to match
+		string rebuiltSha256 = patcher.getTargetSha256();
+		if (rebuiltSha256 != patcher.getExpectedSha256() || (!sha256.empty() && rebuiltSha256 != sha256))
+		{
+			_lastError = "The package rebuilt from " + deltaPath + " doesn't match the update.";
+			isOk = false;
+		}
+	}
+
+	base.close();
+	if (!target.close() && isOk)
+	{
+		_lastError = "Cannot write " + partPath + ".";
+		isOk = false;
+	}
+
+	if (isOk)
+	{
+		remove(destTo.c_str());
+		if (rename(partPath.c_str(), destTo.c_str()) != 0)
+		{
+			_lastError = "Cannot rename " + partPath + " to " + destTo + ".";
+			isOk = false;
+		}
+	}
+
+	if (!isOk)
+		remove(partPath.c_str());
+	return isOk;
+}
+
+// Raw bytes of a hexadecimal digest
+static string hexToBytes(const string & hex)
+{
+	string bytes;
+	for (size_t i = 0; i + 1 < hex.size(); i += 2)
+		bytes += static_cast<char>(strtol(hex.substr(i, 2).c_str(), NULL, 16));
+	return bytes;
+}
+
+string GupEngine::getPackagePath(const string & location) const
+{
+	string fileName = getFileName(location);
+
+#ifdef _WIN32
+	// Make sure ShellExecute will run what we downloaded
+	string::size_type dot = fileName.find_last_of('.');
+	if (dot == string::npos || fileName.substr(dot) != ".exe")
+		fileName += ".exe";
+#endif
+
+	string dest = _downloadDir;
+	if (!dest.empty() && dest.back() != PATH_SEPARATOR)
+		dest += PATH_SEPARATOR;
+	return dest + fileName;
+}
+
+const char * GupEngine::getResultName(GupEngineResult result)
+{
+	switch (result)
+	{
+		case gupNoUpdate: return "noUpdate";
+		case gupUpdateDeclined: return "updateDeclined";
+		case gupUpdateInstalled: return "updateInstalled";
+		case gupInstallFailed: return "installFailed";
+		case gupDownloadAborted: return "downloadAborted";
+		case gupNetworkError: return "networkError";
+		case gupPackageCorrupted: return "packageCorrupted";
+		case gupCheckUnknown: return "checkUnknown";
+		case gupCheckDeferred: return "checkDeferred";
+		case gupSignatureInvalid: return "signatureInvalid";
+		case gupUpdatePrefetched: return "updatePrefetched";
+	}
+	return "unknown";
+}
+
+const char * GupEngine::getCacheResultName(GupCacheResult result)
+{
+	switch (result)
+	{
+		case gupCacheNotUsed: return "off";
+		case gupCacheMiss: return "miss";
+		case gupCacheRevalidated: return "revalidated";
+		case gupCacheFresh: return "fresh";
+	}
+	return "unknown";
+}
+
+// Callbacks of a download started while askToDownload() is waiting for the user: quiet until the answer,
+// then the ones of the caller if it's yes, an abort if it's no. Called from the thread of the download
+class PrefetchCallbacks : public GupEngineCallbacks
+{
+public:
+	explicit PrefetchCallbacks(GupEngineCallbacks & callbacks) : _callbacks(callbacks) {};
+
+	void answer(bool isAccepted) { _answer = isAccepted ? answerYes : answerNo; };
+
+	void onDownloadStart(const string & packagePath) override
+	{
+		_packagePath = packagePath;
+		_isStarted = _answer == answerYes;
+		if (_isStarted)
+			_callbacks.onDownloadStart(packagePath);
+	};
+
+	bool onProgress(int64_t dlTotal, int64_t dlNow) override
+	{
+		int answer = _answer;
+		if (answer != answerYes)
+			return answer == answerPending;
+
+		// The progress bar shows up with the yes, on what is left to download
+		if (!_isStarted)
+		{
+			_isStarted = true;
+			_callbacks.onDownloadStart(_packagePath);
+		}
+		return _callbacks.onProgress(dlTotal, dlNow);
+	};
+
+	bool isPaused() override { return _answer == answerYes && _callbacks.isPaused(); };
+
+private:
+	enum { answerPending, answerYes, answerNo };
+
+	GupEngineCallbacks & _callbacks;
+	atomic<int> _answer{answerPending};
+	string _packagePath;
+	bool _isStarted = false;
+};
+
+GupEngineResult GupEngine::run(GupEngineCallbacks & callbacks)
+{
+	_newVersion.clear();
+	if (!_isInfoChecked)
+		_lastError.clear();
+	if (_logPath.empty())
+		return runSteps(callbacks);
+
+	try {
+		GupEngineResult result = runSteps(callbacks);
+		writeLog(getResultName(result));
+		return result;
+	}
+	catch (const exception & ex)
+	{
+		// An update info which can't be parsed
+		_lastError = ex.what();
+		writeLog("invalidUpdateInfo");
+		throw;
+	}
+}
+
+GupEngineResult GupEngine::runSteps(GupEngineCallbacks & callbacks)
+{
+	//
+	// Get update info
+	//
+	if (_isLowPriority)
+		enterBackgroundMode();
+
+	// Not a single request before the time the server asked for
+	GupCheckSchedule schedule;
+	loadSchedule(schedule);
+	int64_t nextCheckIn = getNextCheckIn(schedule);
+	if (nextCheckIn > 0)
+	{
+		_stats.nextCheckIn = nextCheckIn;
+		_lastError = "The update server asked to check again later.";
+		return gupCheckDeferred;
+	}
+
+	// Already done along with other products (checkUpdates)
+	std::string updateInfo;
+	bool isInfoOk = false;
+	if (_isInfoChecked)
+	{
+		updateInfo.swap(_checkedInfo);
+		isInfoOk = _isInfoCheckOk;
+		_isInfoChecked = false;
+	}
+	else
+	{
+		isInfoOk = getUpdateInfo(updateInfo);
+	}
+
+	if (!isInfoOk)
+	{
+		if (_isCheckDeferred)
+		{
+			scheduleNextCheck(schedule, _retryAfter);
+			return gupCheckDeferred;
+		}
+
+		// A slow answer is no error: the next run will tell
+		if (_isCheckOverBudget)
+			return gupCheckUnknown;
+
+		callbacks.onError(_lastError);
+		return gupNetworkError;
+	}
+
+	// With keys pinned in gup.xml, nothing but an update info signed with one of them is taken into account,
+	// whatever the connection it came through
+	auto parseStart = chrono::steady_clock::now();
+	if (!isSignedWithPinnedKey(updateInfo.data(), updateInfo.size(), _infoSignature))
+	{
+		_lastError = "The update info isn't signed with a public key of gup.xml.";
+		return gupSignatureInvalid;
+	}
+
+	GupDownloadInfo gupDlInfo(updateInfo, _gupParams.getChannel());
+	gupDlInfo.compareVersion(_gupParams.getCurrentVersion());
+	_stats.parseTime = secondsSince(parseStart);
+	_newVersion = gupDlInfo.getVersion();
+
+	// A fresh answer of the cache has already been taken into account when it was received
+	if (_stats.infoCacheResult != gupCacheFresh)
+		scheduleNextCheck(schedule, max<int64_t>(_retryAfter, max(gupDlInfo.getRetryAfter(), gupDlInfo.getMinCheckInterval())));
+
+	if (!gupDlInfo.doesNeed2BeUpdated())
+		return gupNoUpdate;
+
+	// Staged rollout: the other machines get the update in a later run, once the server raises the percentage.
+	// A seed drawn now is kept, or the machine would draw its luck again at every run.
+	bool isInRollout = schedule.isInRollout(_newVersion, gupDlInfo.getRollout());
+	if (!isInRollout || schedule.isSeedNew())
+		saveSchedule(schedule);
+	if (!isInRollout)
+	{
+		_stats.isOutOfRollout = true;
+		return gupNoUpdate;
+	}
+
+	// The package comes from mirrors and caches nobody vouches for: the signature of its SHA-256 is checked now,
+	// then the hash computed while it's received (see downloadBinary) ties it to this digest
+	if (!_gupParams.getPublicKeys().empty())
+	{
+		string digest = hexToBytes(gupDlInfo.getSha256());
+		if (digest.empty() || !isSignedWithPinnedKey(digest.data(), digest.size(), gupDlInfo.getSignature()))
+		{
+			_lastError = "The update package isn't signed with a public key of gup.xml.";
+			return gupSignatureInvalid;
+		}
+	}
+
+	//
+	// Process Update Info
+	//
+	string dlDest = getPackagePath(gupDlInfo.getDownloadLocation());
+	bool isDownloaded = false;
+
+	// Only a download nobody waits for stays in the background
+	if (_isLowPriority && _prefetchMode != gupPrefetchOnly)
+		leaveBackgroundMode();
+
+	if (_prefetchMode == gupPrefetchOnly)
+	{
+		// For a later run, which finds the package ready
+		isDownloaded = downloadPackage(gupDlInfo, dlDest, callbacks);
+		if (isDownloaded)
+		{
+			publishPackage(gupDlInfo, dlDest, callbacks);
+			return gupUpdatePrefetched;
+		}
+	}
+	else if (_prefetchMode == gupPrefetchWhileAsking)
+	{
+		// The download goes on while the user reads the question: a yes finds the package (or most of it) on disk
+		PrefetchCallbacks prefetchCallbacks(callbacks);
+		thread prefetch([&]() {
+			isDownloaded = downloadPackage(gupDlInfo, dlDest, prefetchCallbacks);
+		});
+
+		bool isAccepted = callbacks.askToDownload(gupDlInfo);
+		auto answerTime = chrono::steady_clock::now();
+		prefetchCallbacks.answer(isAccepted);
+		prefetch.join();
+		if (!isAccepted)
+			return gupUpdateDeclined;
+		_stats.downloadWaitTime = secondsSince(answerTime);
+	}
+	else
+	{
+		if (!callbacks.askToDownload(gupDlInfo))
+			return gupUpdateDeclined;
+
+		//
+		// Download executable bin
+		//
+		auto answerTime = chrono::steady_clock::now();
+		isDownloaded = downloadPackage(gupDlInfo, dlDest, callbacks);
+		_stats.downloadWaitTime = secondsSince(answerTime);
+	}
+
+	if (!isDownloaded)
+	{
+		if (_isAborted)
+			return gupDownloadAborted;
+		if (_isCorrupted)
+			return gupPackageCorrupted;
+
+		callbacks.onError(_lastError);
+		return gupNetworkError;
+	}
+
+	//
+	// Run executable bin
+	//
+	auto installStart = chrono::steady_clock::now();
+	bool isInstalled = callbacks.install(dlDest);
+	_stats.installTime = secondsSince(installStart);
+
+	// Nobody waits for the copy for the next machines: the installer already has the package
+	publishPackage(gupDlInfo, dlDest, callbacks);
+	return isInstalled ? gupUpdateInstalled : gupInstallFailed;
+}
+
+bool GupEngine::downloadPackage(const GupDownloadInfo & gupDlInfo, const string & dlDest, GupEngineCallbacks & callbacks)
+{
+	_isAborted = false;
+	_isCorrupted = false;
+	if (isPackageReady(dlDest, gupDlInfo.getSha256()))
+	{
+		_stats.isPackageReady = true;
+		return true;
+	}
+
+	string packageName = getFileName(gupDlInfo.getDownloadLocation());
+
+	// The copies of the local network first, even before a delta from the Internet.
+	// Only the hash of the update info tells they hold the right package
+	vector<string> sources;
+	if (!gupDlInfo.getSha256().empty())
+	{
+		for (const GupPackageSource & source : _extraOptions.getPackageSources())
+			sources.push_back(source.location + packageName);
+	}
+	bool isDownloaded = !sources.empty() && downloadBinary(sources, dlDest, callbacks, gupDlInfo.getSha256());
+
+	const GupDelta *delta = _isDeltaEnabled ? gupDlInfo.findDelta(_gupParams.getCurrentVersion()) : NULL;
+	if (!isDownloaded && !_isAborted && delta)
+		isDownloaded = downloadDelta(*delta, dlDest, callbacks, gupDlInfo.getSha256());
+
+	// A delta which didn't work out only cost its size: get the full package
+	if (!isDownloaded && !_isAborted)
+		isDownloaded = downloadBinary(rankMirrors(gupDlInfo.getMirrors()), dlDest, callbacks, gupDlInfo.getSha256());
+
+	return isDownloaded;
+}
+
+bool GupEngine::isPackageReady(const string & path, const string & sha256)
+{
+	// Without a hash, nothing tells it's the package announced rather than an older one of the same name
+	OutputFile file;
+	if (sha256.empty() || !file.openForReading(path))
+		return false;
+
+	auto verifyStart = chrono::steady_clock::now();
+	Sha256 hash;
+	bool isReady = hashFileUpTo(file, hash, OutputFile::getSize(path)) && hash.finish() == sha256;
+	_stats.verifyTime += secondsSince(verifyStart);
+	return isReady;
+}
+
+bool GupEngine::isSignedWithPinnedKey(const void *data, size_t len, const string & signature) const
+{
+	const vector<string> & publicKeys = _gupParams.getPublicKeys();
+	if (publicKeys.empty())
+		return true;
+
+	for (const string & publicKey : publicKeys)
+	{
+		if (Ed25519Verifier::verify(publicKey, signature, data, len))
+			return true;
+	}
+	return false;
+}
+
+int64_t GupEngine::getNextCheckIn(const GupCheckSchedule & schedule) const
+{
+	// A date too far away comes from a clock which has gone back
+	int64_t nextCheckIn = schedule.getNextCheck() - static_cast<int64_t>(time(NULL));
+	return _isScheduleEnabled && nextCheckIn > 0 && nextCheckIn <= 2 * MAX_CHECK_DELAY ? nextCheckIn : 0;
+}
+
+void GupEngine::scheduleNextCheck(GupCheckSchedule & schedule, int64_t delay)
+{
+	int64_t previousCheck = schedule.getNextCheck();
+	schedule.deferCheck(static_cast<int64_t>(time(NULL)), min(delay, MAX_CHECK_DELAY));
+	if (schedule.getNextCheck() != previousCheck)
+		saveSchedule(schedule);
+
+	if (schedule.getNextCheck() > 0)
+		_stats.nextCheckIn = schedule.getNextCheck() - static_cast<int64_t>(time(NULL));
+}
+
+static string jsonString(const string & value)
+{
+	string json = "\"";
+	for (unsigned char c : value)
+	{
+		if (c == '"' || c == '\\')
+		{
+			json += '\\';
+			json += static_cast<char>(c);
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			json += escaped;
+		}
+		else
+		{
+			json += static_cast<char>(c);
+		}
+	}
+	return json + "\"";
+}
+
+static string jsonTimes(const GupTransferTimes & times)
+{
+	// Durations of the phases, rather than curl's times from the start of the transfer
+	char json[256];
+	snprintf(json, sizeof(json), "\"http\":\"%s\",\"reused\":%s,\"dns\":%.6f,\"connect\":%.6f,\"tls\":%.6f,\"ttfb\":%.6f,\"transfer\":%.6f",
+		times.httpVersion, times.isReused ? "true" : "false",
+		times.nameLookup,
+		times.connect > times.nameLookup ? times.connect - times.nameLookup : 0,
+		times.appConnect > times.connect ? times.appConnect - times.connect : 0,
+		times.startTransfer > 0 ? times.startTransfer - max(times.connect, times.appConnect) : 0,
+		times.total > times.startTransfer ? times.total - times.startTransfer : 0);
+	return json;
+}
+
+void GupEngine::writeLog(const char *result) const
+{
+	FILE *log = fopen(_logPath.c_str(), "a");
+	if (!log)
+		return;
+
+	char date[32] = "";
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	// One object per line (JSON Lines), so the logs of many machines can simply be concatenated
+	fprintf(log, "{\"date\":\"%s\",\"software\":%s,\"version\":%s,\"newVersion\":%s,\"result\":\"%s\",\"error\":%s,",
+		date, jsonString(_gupParams.getSoftwareName()).c_str(), jsonString(_gupParams.getCurrentVersion()).c_str(),
+		jsonString(_newVersion).c_str(), result, jsonString(_lastError).c_str());
+
+	fprintf(log, "\"check\":{\"url\":%s,\"cache\":\"%s\",\"bytes\":%lld,\"total\":%.6f,%s,\"parse\":%.6f,\"nextCheckIn\":%lld,\"outOfRollout\":%s},",
+		jsonString(_gupParams.getInfoLocation()).c_str(), getCacheResultName(_stats.infoCacheResult), static_cast<long long>(_stats.checkBytes), _stats.checkTime,
+		jsonTimes(_stats.checkTimes).c_str(), _stats.parseTime, static_cast<long long>(_stats.nextCheckIn), _stats.isOutOfRollout ? "true" : "false");
+
+	fprintf(log, "\"download\":{\"probe\":%.6f,\"failovers\":%d,\"url\":%s,\"ip\":%s,\"bytes\":%lld,\"total\":%.6f,%s,\"write\":%.6f,\"verify\":%.6f,\"paused\":%.6f,\"ready\":%s,\"wait\":%.6f,\"delta\":%s,\"patch\":%.6f,\"publish\":%.6f},",
+		_stats.mirrorProbeTime, _stats.mirrorFailovers, jsonString(_stats.downloadUrl).c_str(), jsonString(_stats.downloadIp).c_str(), static_cast<long long>(_stats.downloadedBytes),
+		_stats.downloadTime, jsonTimes(_stats.downloadTimes).c_str(), _stats.writeTime, _stats.verifyTime, _stats.pausedTime,
+		_stats.isPackageReady ? "true" : "false", _stats.downloadWaitTime,
+		_stats.isDeltaApplied ? "true" : "false", _stats.patchTime, _stats.publishTime);
+
+	fprintf(log, "\"install\":%.6f}\n", _stats.installTime);
+	fclose(log);
+}
@@ -0,0 +1,313 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GUPENGINE_H
+#define GUPENGINE_H
+
+#include <stdint.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "bandwidthScheduler.h"
+#include "sha256.h"
+#include "xmlTools.h"
+
+class OutputFile;
+struct GupSession;
+struct ResponseHeaders;
+struct UpdateInfoRequest;
+
+//
+// The update engine does the check/download/install pipeline without any UI:
+// everything the user has to see or decide goes through GupEngineCallbacks,
+// so the same code runs behind the Win32 dialogs and behind a command line driver.
+//
+
+enum GupEngineResult
+{
+	gupNoUpdate,          // the server says the program is up to date
+	gupUpdateDeclined,    // askToDownload() returned false
+	gupUpdateInstalled,   // the package has been downloaded and install() succeeded
+	gupInstallFailed,     // the package has been downloaded but install() failed
+	gupDownloadAborted,   // onProgress() returned false during the download
+	gupNetworkError,      // curl failed, see GupEngine::getLastError()
+	gupPackageCorrupted,  // the package doesn't match the Hash of the update info: deleted, not installed
+	gupCheckUnknown,      // the update check didn't complete within its time budget: try again later
+	gupCheckDeferred,     // the server asked not to check before some time (Retry-After, MinCheckInterval): nothing sent
+	gupSignatureInvalid,  // gup.xml pins public keys, and the update info or its package isn't signed with one of them
+	gupUpdatePrefetched   // gupPrefetchOnly: the package is downloaded and verified, for a later run
+};
+
+enum GupPrefetchMode
+{
+	gupPrefetchOff,          // the download starts once askToDownload() returns true
+	gupPrefetchWhileAsking,  // the download starts with askToDownload(), and stops if it returns false
+	gupPrefetchOnly          // download the package without asking nor installing: the next run finds it ready
+};
+
+class GupEngineCallbacks
+{
+public:
+	virtual ~GupEngineCallbacks() {};
+
+	// An update is available: return false to stop here
+	virtual bool askToDownload(const GupDownloadInfo &) { return true; };
+
+	// Called once the destination file is opened, just before the transfer.
+	// With gupPrefetchWhileAsking, this one, onProgress() and isPaused() come from the thread of the download,
+	// from the answer of askToDownload() on
+	virtual void onDownloadStart(const std::string &) {};
+
+	// dlTotal is 0 while the size is still unknown. Return false to abort the download
+	virtual bool onProgress(int64_t, int64_t) { return true; };
+
+	// Polled during the download: while it returns true, the download is paused, its connections kept.
+	// onProgress() isn't called meanwhile, stop pausing to abort it.
+	virtual bool isPaused() { return false; };
+
+	// The package is on disk: run it
+	virtual bool install(const std::string &) { return true; };
+
+	// Polled while the package is copied to the package sources, once the installer has it: return true to stop
+	virtual bool isPublishStopped() { return false; };
+
+	// Network error (curl error buffer content)
+	virtual void onError(const std::string &) {};
+};
+
+enum GupCacheResult
+{
+	gupCacheNotUsed,
+	gupCacheMiss,         // nothing usable in the cache: full request
+	gupCacheRevalidated,  // conditional request answered by 304 Not Modified
+	gupCacheFresh         // no request at all
+};
+
+// Phases of a transfer, in seconds from its start (CURLINFO_*_TIME_T)
+struct GupTransferTimes
+{
+	double nameLookup = 0;
+	double connect = 0;
+	double appConnect = 0;     // TLS handshake done, 0 without TLS
+	double startTransfer = 0;  // first byte of the answer
+	double total = 0;
+	bool isReused = false;     // on a connection of an earlier transfer of the run: no connect nor handshake
+	const char *httpVersion = "";  // "1.1", "2"...
+};
+
+struct GupEngineStats
+{
+	GupCacheResult infoCacheResult = gupCacheNotUsed;
+	GupTransferTimes checkTimes;  // of the request to InfoUrl, if it has been sent
+	double checkTime = 0;      // seconds spent in getUpdateInfo()
+	long checkHttpCode = 0;    // status of the answer of InfoUrl, 0 without answer
+	int checkError = 0;        // CURLcode of the request to InfoUrl
+	int64_t checkBytes = 0;    // of the answer of InfoUrl, as received (compressed)
+	double parseTime = 0;      // seconds checking the signature of the update info and parsing it
+	int64_t nextCheckIn = 0;   // seconds before the server allows the next check, 0: any time
+	bool isOutOfRollout = false;  // there is an update, not offered to this machine yet
+
+	double mirrorProbeTime = 0;  // seconds spent choosing among the mirrors of the package
+	int mirrorFailovers = 0;   // times the download moved to the next mirror
+
+	std::string downloadUrl;   // of the last download: the package or its delta, from the last mirror tried
+	std::string downloadIp;    // address of the server which sent it
+	GupTransferTimes downloadTimes;  // of its first connection
+	double downloadTime = 0;   // seconds spent in downloadBinary()
+	int64_t downloadedBytes = 0;
+	double writeTime = 0;      // seconds writing the package to disk
+	double verifyTime = 0;     // seconds hashing the package
+	double pausedTime = 0;     // seconds the download has been paused (GupEngineCallbacks::isPaused())
+	bool isPackageReady = false;  // the package was on disk and verified already (prefetched by an earlier run)
+	double downloadWaitTime = 0;  // seconds from the yes of askToDownload() to the package on disk
+	bool isDeltaApplied = false;
+	double patchTime = 0;      // seconds spent rebuilding the package from a delta
+	double publishTime = 0;    // seconds copying the package to the package sources (GupExtraOptions::getPackageSources)
+	double installTime = 0;    // seconds spent in GupEngineCallbacks::install()
+};
+
+class GupEngine
+{
+public:
+	GupEngine(const GupParameters & gupParams, const GupExtraOptions & extraOptions);
+
+	// Check, ask, download then install
+	GupEngineResult run(GupEngineCallbacks & callbacks);
+
+	// The update checks of several products at once, each engine with its own gup.xml: their requests share
+	// the connections to the update servers, and so do their downloads. Then run() of each engine goes on from
+	// the answer it got
+	static void checkUpdates(const std::vector<GupEngine *> & engines);
+	// Load test of the update server: each engine is a machine of a fleet, with its own connections, DNS and
+	// TLS sessions (setStateless() is expected). At most concurrency checks are in flight over one multi handle,
+	// started at checksPerSecond at most (0: as fast as they end). Then run() of each engine goes on from the
+	// answer it got, as after checkUpdates(), and getStats() tells its status and time
+	static void simulateFleet(const std::vector<GupEngine *> & engines, int concurrency, double checksPerSecond);
+
+	static const char * getResultName(GupEngineResult result);
+	static const char * getCacheResultName(GupCacheResult result);
+
+	bool getUpdateInfo(std::string & info2get);
+	// If sha256 isn't empty, the package is hashed while it is received and deleted if it doesn't match
+	bool downloadBinary(const std::string & urlFrom, const std::string & destTo, GupEngineCallbacks & callbacks, const std::string & sha256 = "");
+	// Mirrors are tried in this order, each one continuing what the previous one has sent
+	bool downloadBinary(const std::vector<std::string> & mirrors, const std::string & destTo, GupEngineCallbacks & callbacks, const std::string & sha256 = "");
+	// Fastest first (answer time divided by the weight), then the ones which didn't answer
+	std::vector<std::string> rankMirrors(const std::vector<GupMirror> & mirrors);
+
+	// Where the package of the given location will be downloaded
+	std::string getPackagePath(const std::string & location) const;
+	void setDownloadDir(const std::string & dir) { _downloadDir = dir; };
+
+	// Where the answers of InfoUrl are kept between runs (the download directory by default)
+	void setCacheDir(const std::string & dir) { _cacheDir = dir; };
+	void setInfoCacheEnabled(bool isEnabled) { _isInfoCacheEnabled = isEnabled; };
+	std::string getCachePath(const char *fileName) const;
+
+	// Number of parallel ranges used to download the package (1: single stream)
+	void setSegmentCount(int segmentCount) { _segmentCount = segmentCount > 0 ? segmentCount : 1; };
+	int getSegmentCount() const { return _segmentCount; };
+
+	// Download a delta from the current version instead of the full package when the update info has one
+	void setDeltaEnabled(bool isEnabled) { _isDeltaEnabled = isEnabled; };
+
+	// A connection slower than minSpeed (bytes per second) for minSpeedTime seconds moves the download to the next mirror
+	void setMinSpeed(long minSpeed, long minSpeedTime) { _minSpeed = minSpeed; _minSpeedTime = minSpeedTime; };
+
+	// Rate cap in bytes per second (0: none), and background mode: only use the bandwidth nobody else is using
+	void setBandwidthPolicy(int64_t maxRate, bool isBackground) { _bandwidth.setPolicy(maxRate, isBackground); };
+
+	// Time budget of the update check in milliseconds (0: no limit): over it, run() returns gupCheckUnknown
+	void setCheckTimeout(long totalMs, long connectMs) { _checkTimeout = totalMs; _checkConnectTimeout = connectMs; };
+	// Lower the CPU and disk priority of the process during the update check, and the download of gupPrefetchOnly
+	void setLowPriority(bool isLowPriority) { _isLowPriority = isLowPriority; };
+	// Download the package while askToDownload() waits for the user, or for a later run (see GupPrefetchMode)
+	void setPrefetchMode(GupPrefetchMode mode) { _prefetchMode = mode; };
+	// Ask InfoUrl for the binary manifest (on by default), the server answers in XML if it doesn't know it
+	void setBinaryManifestEnabled(bool isEnabled) { _isBinaryManifestEnabled = isEnabled; };
+
+	// Honour the server hints which put off the next checks (on by default). Off, the check is sent anyway:
+	// the user asked for it
+	void setScheduleEnabled(bool isEnabled) { _isScheduleEnabled = isEnabled; };
+	// Nothing read from nor written to the disk between runs: neither the answers of InfoUrl nor the schedule,
+	// whose rollout draw is then new for each engine, as for the virtual machines of simulateFleet()
+	void setStateless(bool isStateless) { _isStateless = isStateless; };
+
+	// Each run() appends a line of JSON to this file: result, error and timings of every phase
+	void setLogPath(const std::string & path) { _logPath = path; };
+
+	const std::string & getUserAgent() const { return _userAgent; };
+	const std::string & getLastError() const { return _lastError; };
+	const GupEngineStats & getStats() const { return _stats; };
+
+private:
+	const GupParameters & _gupParams;
+	const GupExtraOptions & _extraOptions;
+	std::shared_ptr<GupSession> _session;  // connections, DNS and TLS sessions of all the transfers
+	std::string _userAgent;
+	std::string _downloadDir;
+	std::string _cacheDir;
+	bool _isInfoCacheEnabled = true;
+	std::string _lastError;
+	bool _isAborted = false;
+	bool _isCorrupted = false;
+	int _segmentCount = 1;
+	bool _isDeltaEnabled = true;
+	long _minSpeed = 0;
+	long _minSpeedTime = 10;
+	bool _isSpeedFloorOn = false; // not on the last mirror: slow is better than nothing
+	bool _isTooSlow = false;      // the last transfer went below the speed floor
+	BandwidthScheduler _bandwidth;
+	bool _isPaused = false;       // by GupEngineCallbacks::isPaused()
+	bool _isHeld = false;         // the transfers are paused: on demand or to keep to the rate
+	std::chrono::steady_clock::time_point _pausedSince;
+	long _checkTimeout = 0;
+	long _checkConnectTimeout = 0;
+	bool _isCheckOverBudget = false;
+	bool _isScheduleEnabled = true;
+	bool _isStateless = false;
+	bool _isCheckDeferred = false;  // the server answered it's too busy
+	int64_t _retryAfter = 0;        // Retry-After header of the last answer of InfoUrl
+	bool _isInfoChecked = false;    // by checkUpdates(): the answer is in _checkedInfo
+	bool _isInfoCheckOk = false;
+	std::string _checkedInfo;
+	std::string _infoSignature;     // GUP-Signature of the update info, of its answer or of the cache
+	bool _isLowPriority = false;
+	bool _isBinaryManifestEnabled = true;
+	GupPrefetchMode _prefetchMode = gupPrefetchOff;
+	std::string _logPath;
+	std::string _newVersion;
+	GupPartialDownload _partial;  // what the current download has written so far
+	bool _isHashing = false;
+	Sha256 _packageHash;          // of the bytes of the package received without hole so far
+	GupEngineStats _stats;
+
+	GupEngineResult runSteps(GupEngineCallbacks & callbacks);
+	// getUpdateInfo() in two halves, around the transfer: false from begin if the request has to be sent
+	bool beginUpdateInfo(UpdateInfoRequest & request, std::string & info2get);
+	bool endUpdateInfo(UpdateInfoRequest & request, int result, std::string & info2get);
+	// For checkUpdates() and simulateFleet(): false if the check is already over (answer of the cache, no curl),
+	// else request.curl is to be performed, then given to endUpdateInfo() with _checkedInfo
+	bool beginCheck(UpdateInfoRequest & request);
+	void loadSchedule(GupCheckSchedule & schedule) const;
+	void saveSchedule(const GupCheckSchedule & schedule) const;
+
+	// Seconds before the server allows the next check, 0: now (or the schedule isn't honoured)
+	int64_t getNextCheckIn(const GupCheckSchedule & schedule) const;
+	// True if no key is pinned in gup.xml
+	bool isSignedWithPinnedKey(const void *data, size_t len, const std::string & signature) const;
+	// The server hints of the update check, in seconds from now
+	void scheduleNextCheck(GupCheckSchedule & schedule, int64_t delay);
+	void writeLog(const char *result) const;
+
+	void makeUserAgent();
+	std::string getInfoUrl() const;
+	void setCommonOptions(void *curl, char *errorBuffer) const;
+
+	void setSpeedFloor(void *curl, int connectionCount) const;
+	// Between two curl_multi_perform() of a download: pause on demand and bandwidth policy.
+	// received is what the transfers have received so far, rttUs the round trip time of one of their connections
+	// (-1 if unknown). Returns how long to wait for the next call at most, in milliseconds
+	long scheduleTransfers(const std::vector<void *> & handles, int64_t received, int64_t rttUs, GupEngineCallbacks & callbacks);
+	void endTransfers();
+	// curl_easy_perform() of a single stream download, scheduled like the segmented ones.
+	// socket is the curl_socket_t its connection is on (see watchSocket)
+	int performDownload(void *curl, const void *socket, GupEngineCallbacks & callbacks);
+	// The download comes from a copy on the local network
+	bool isPackageSource(const std::string & url) const;
+	// Copy the package to the package sources which asked for it, for the next machines
+	void publishPackage(const GupDownloadInfo & gupDlInfo, const std::string & packagePath, GupEngineCallbacks & callbacks);
+	bool downloadFromMirror(const std::string & urlFrom, const std::string & destTo, GupPartialDownload previous, GupEngineCallbacks & callbacks);
+	bool resumeHash(OutputFile & file, const GupPartialDownload & previous, int64_t resumeFrom);
+	bool downloadSingleStream(const std::string & urlFrom, const std::string & destTo, const GupPartialDownload & previous, GupEngineCallbacks & callbacks);
+	// HEAD request: true if the server accepts byte ranges and tells the package size
+	bool probeRanges(const std::string & url, int64_t & fileSize, std::string & effectiveUrl, ResponseHeaders & headers);
+	bool downloadSegments(const std::string & url, const std::string & destTo, int64_t fileSize, int64_t resumeFrom, int segmentCount, GupEngineCallbacks & callbacks);
+
+	// From the package sources, a delta or the mirrors, unless it's ready in dlDest
+	bool downloadPackage(const GupDownloadInfo & gupDlInfo, const std::string & dlDest, GupEngineCallbacks & callbacks);
+	// The file is the package of this SHA-256, downloaded by an earlier run
+	bool isPackageReady(const std::string & path, const std::string & sha256);
+	// False if the delta can't be used: the full package is downloaded then
+	bool downloadDelta(const GupDelta & delta, const std::string & destTo, GupEngineCallbacks & callbacks, const std::string & sha256);
+	bool applyDelta(const std::string & basePath, int64_t baseSize, const std::string & deltaPath, const std::string & destTo, const std::string & sha256);
+};
+
+#endif // GUPENGINE_H
@@ -0,0 +1,144 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include "gupVersion.h"
+
+using namespace std;
+
+static vector<string> split(const string & value, char separator)
+{
+	vector<string> parts;
+	string::size_type start = 0;
+	for (;;)
+	{
+		string::size_type end = value.find(separator, start);
+		parts.push_back(value.substr(start, end == string::npos ? string::npos : end - start));
+		if (end == string::npos)
+			return parts;
+		start = end + 1;
+	}
+}
+
+static bool isNumber(const string & value)
+{
+	if (value.empty())
+		return false;
+
+	for (char c : value)
+	{
+		if (!isdigit(static_cast<unsigned char>(c)))
+			return false;
+	}
+	return true;
+}
+
+// Numbers of any length, without overflow: the longer one is bigger once the leading zeros are gone
+static int compareNumbers(const string & a, const string & b)
+{
+	string::size_type aStart = a.find_first_not_of('0');
+	string::size_type bStart = b.find_first_not_of('0');
+	string aDigits = aStart == string::npos ? "" : a.substr(aStart);
+	string bDigits = bStart == string::npos ? "" : b.substr(bStart);
+	if (aDigits.size() != bDigits.size())
+		return aDigits.size() < bDigits.size() ? -1 : 1;
+	return aDigits.compare(bDigits) < 0 ? -1 : aDigits.compare(bDigits) > 0 ? 1 : 0;
+}
+
+GupVersion::GupVersion(const string & version)
+{
+	string::size_type first = version.find_first_not_of(" \t\r\n");
+	string::size_type last = version.find_last_not_of(" \t\r\n");
+	string value = first == string::npos ? "" : version.substr(first, last - first + 1);
+	if (!value.empty() && (value[0] == 'v' || value[0] == 'V'))
+		value.erase(0, 1);
+
+	value = value.substr(0, value.find('+'));
+
+	string::size_type dash = value.find('-');
+	if (dash != string::npos)
+	{
+		_preRelease = split(value.substr(dash + 1), '.');
+		value.erase(dash);
+	}
+
+	if (value.empty())
+		return;
+
+	for (const string & part : split(value, '.'))
+	{
+		Segment segment;
+		string::size_type digits = 0;
+		while (digits < part.size() && isdigit(static_cast<unsigned char>(part[digits])))
+			++digits;
+		string::size_type start = part.find_first_not_of('0');
+		segment.number = start < digits ? part.substr(start, digits - start) : "";
+		segment.suffix = part.substr(digits);
+		_segments.push_back(segment);
+	}
+
+	// "1.2.0" is "1.2"
+	while (!_segments.empty() && _segments.back().number.empty() && _segments.back().suffix.empty())
+		_segments.pop_back();
+}
+
+int GupVersion::compare(const GupVersion & other) const
+{
+	Segment zero;
+	size_t count = max(_segments.size(), other._segments.size());
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Segment & a = i < _segments.size() ? _segments[i] : zero;
+		const Segment & b = i < other._segments.size() ? other._segments[i] : zero;
+		int result = compareNumbers(a.number, b.number);
+		if (result != 0)
+			return result;
+		if (a.suffix != b.suffix)
+			return a.suffix < b.suffix ? -1 : 1;
+	}
+
+	// The release comes after its pre-releases
+	if (_preRelease.empty() || other._preRelease.empty())
+		return _preRelease.empty() == other._preRelease.empty() ? 0 : _preRelease.empty() ? 1 : -1;
+
+	for (size_t i = 0; i < _preRelease.size() && i < other._preRelease.size(); ++i)
+	{
+		const string & a = _preRelease[i];
+		const string & b = other._preRelease[i];
+		bool isANumber = isNumber(a);
+		bool isBNumber = isNumber(b);
+
+		// Numbers are before words: "beta.2" < "beta.rc"
+		int result = 0;
+		if (isANumber && isBNumber)
+			result = compareNumbers(a, b);
+		else if (isANumber != isBNumber)
+			result = isANumber ? -1 : 1;
+		else
+			result = a < b ? -1 : a > b ? 1 : 0;
+
+		if (result != 0)
+			return result;
+	}
+
+	if (_preRelease.size() != other._preRelease.size())
+		return _preRelease.size() < other._preRelease.size() ? -1 : 1;
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GUPVERSION_H
+#define GUPVERSION_H
+
+#include <string>
+#include <vector>
+
+//
+// Version of a program, compared by the client when the update info is a static manifest
+// which only names the latest version (see GupDownloadInfo::isStatic).
+//
+// "1.10" is after "1.9": the segments separated by dots are numbers, and missing ones are 0 ("1.2" is "1.2.0").
+// A segment may end with letters, compared as text after its number: "8.6.9a" is after "8.6.9".
+// Like semantic versioning, a pre-release after a dash is before the release: "2.0-beta.2" < "2.0-beta.10" < "2.0-rc.1" < "2.0",
+// and build metadata after a plus is ignored. A leading "v" is ignored too.
+//
+class GupVersion
+{
+public:
+	explicit GupVersion(const std::string & version);
+
+	// < 0, 0 or > 0, like strcmp
+	int compare(const GupVersion & other) const;
+
+	bool operator<(const GupVersion & other) const { return compare(other) < 0; };
+	bool operator>(const GupVersion & other) const { return compare(other) > 0; };
+	bool operator==(const GupVersion & other) const { return compare(other) == 0; };
+
+	bool isPreRelease() const { return !_preRelease.empty(); };
+
+private:
+	struct Segment {
+		std::string number;  // digits, without the leading zeros: "" is 0, and no number is too long
+		std::string suffix;  // letters after the number
+	};
+
+	std::vector<Segment> _segments;
+	std::vector<std::string> _preRelease;  // identifiers separated by dots
+};
+
+#endif // GUPVERSION_H
@@ -0,0 +1,842 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+//
+// Headless command line driver of the update engine.
+// It runs the same check/download pipeline as WinGup, without any dialog,
+// so the update path can be profiled and load-tested outside of Windows (see linux/bench.sh).
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <curl/curl.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include "xmlTools.h"
+#include "gupEngine.h"
+#include "commandLine.h"
+#include "progressChannel.h"
+
+using namespace std;
+
+// Ctrl+C aborts the download like the Cancel button of WinGup, so it can be resumed
+static volatile sig_atomic_t isInterrupted = 0;
+
+static void onInterrupt(int)
+{
+	isInterrupted = 1;
+}
+
+// SIGUSR1 pauses the download, a second one resumes it
+static volatile sig_atomic_t isPauseRequested = 0;
+
+static void onPauseToggle(int)
+{
+	isPauseRequested = !isPauseRequested;
+}
+
+const char MSGID_HELP[] = "Usage :\n\
+\n\
+gupcli [--help] [-verbose] [-vVERSION_VALUE] [-pCUSTOM_PARAM] [--channel NAME] [--config FILE] [--options FILE]\n\
+       [--dest DIR] [--cache-dir DIR] [--no-cache] [--segments N] [--no-delta] [--min-speed KBPS] [--min-speed-time S]\n\
+       [--check-only] [--yes] [--check-timeout MS] [--connect-timeout MS] [--low-priority] [--install COMMAND]\n\
+       [--max-rate KBPS] [--background] [--force] [--xml-manifest] [--prefetch | --prefetch-only] [--stats] [--log FILE]\n\
+gupcli --bench-parse N\n\
+gupcli [--config FILE] [--options FILE] --bench-startup N\n\
+gupcli --bench-cmdline N\n\
+gupcli --bench-progress MS\n\
+gupcli [--config FILE] [--options FILE] [-vVERSION_VALUE] [-pCUSTOM_PARAM] [--channel NAME] [--check-timeout MS]\n\
+       [--connect-timeout MS] [--xml-manifest] --fleet N [--fleet-concurrency C] [--fleet-rate R]\n\
+       [--fleet-versions V1,V2...] [--fleet-params P1,P2...]\n\
+\n\
+    --help : Show this help message (and quit program).\n\
+    -v : Launch GUP with VERSION_VALUE (overrides the version set in gup.xml).\n\
+    -p : Launch GUP with CUSTOM_PARAM (overrides the param set in gup.xml).\n\
+    --channel : Release channel taken from a static manifest (overrides the Channel set in gup.xml).\n\
+    -verbose : Show error/warning message and download progress.\n\
+    --config : Path of gup.xml (default: gup.xml). Repeated, the products are checked at once, on shared connections,\n\
+               and each result line starts with the path of its gup.xml.\n\
+    --options : Path of gupOptions.xml (default: gupOptions.xml).\n\
+    --dest : Directory where the update package is downloaded (default: $TMPDIR or /tmp).\n\
+    --cache-dir : Directory of the update check cache (default: the download directory).\n\
+    --no-cache : Always ask InfoUrl, without conditional request.\n\
+    --segments : Download the package with N parallel ranges (overrides gupOptions.xml).\n\
+    --no-delta : Always download the full package, even if the update info has a delta.\n\
+    --min-speed : Throughput floor in KB/s under which the download moves to the next mirror (overrides gupOptions.xml).\n\
+    --min-speed-time : Seconds below this floor before moving to the next mirror.\n\
+    --check-only : Only check if an update is available.\n\
+    --yes : Download the update without asking.\n\
+    --check-timeout : Time budget of the update check in milliseconds, the result is checkUnknown over it.\n\
+    --connect-timeout : Part of this budget given to the connection, in milliseconds.\n\
+    --low-priority : Check with a background CPU and disk priority (the nice value stays unless privileged).\n\
+    --install : Command to run with the downloaded package path as argument.\n\
+    --max-rate : Cap of the download rate in KB/s (overrides gupOptions.xml).\n\
+    --background : Only use the bandwidth nobody else is using (adapts the rate to the round trip time).\n\
+    --force : Check even if the server asked to wait (Retry-After, MinCheckInterval), result checkDeferred otherwise.\n\
+    --xml-manifest : Ask InfoUrl for the XML answer only, not the binary manifest (overrides gupOptions.xml).\n\
+    --prefetch : Download the package while asking whether to download it (overrides gupOptions.xml).\n\
+    --prefetch-only : Download and verify the package without asking nor installing, result updatePrefetched:\n\
+                      the next run finds it ready.\n\
+    --stats : Print one line of timing statistics on stdout (dlReused: the download went on a connection of the check).\n\
+    --log : Append the result and the timings of every phase to FILE, as a line of JSON (overrides gupOptions.xml).\n\
+    --bench-parse : Parse a typical update info N times, as XML then as binary manifest, and print the size and time of each.\n\
+    --bench-startup : Read gup.xml, gupOptions.xml and nativeLang.xml (current directory) N times like WinGup at startup,\n\
+                      and print the time of the first and the next reads (from the snapshots of the first one),\n\
+                      the heap they keep and the peak memory.\n\
+    --bench-cmdline : Parse N random WinGup command lines (quotes, backslashes, blanks) and check the options read back,\n\
+                      then print the parse time of ever longer command lines.\n\
+    --bench-progress : Push progress samples through the channel of the WinGup progress dialog for MS milliseconds, as\n\
+                       fast as a transfer thread can, while another thread takes them at 30 Hz. Prints the cost of a push\n\
+                       and what reached the other side.\n\
+    --fleet : Load test of the update server: the update checks of N machines, each with its own connections and\n\
+              nothing on disk. Prints the request rate, the latency percentiles of the checks, then their count\n\
+              per result (with the HTTP status or the curl error when there is one).\n\
+    --fleet-concurrency : Checks in flight at most (default: 100).\n\
+    --fleet-rate : Checks started per second at most (default: as fast as they end).\n\
+    --fleet-versions : Current versions of the machines, taken in turn (default: the version of gup.xml).\n\
+    --fleet-params : Custom params of the machines, taken in turn (default: the param of gup.xml).\n\
+\n\
+    kill -USR1 pauses the download, a second time resumes it.\n";
+
+class CliCallbacks : public GupEngineCallbacks
+{
+public:
+	bool _isVerbose = false;
+	bool _isCheckOnly = false;
+	bool _assumeYes = false;
+	string _installCmd;
+	string _newVersion;
+
+	bool askToDownload(const GupDownloadInfo & dlInfo) override
+	{
+		_newVersion = dlInfo.getVersion();
+		if (_isCheckOnly)
+			return false;
+		if (_assumeYes)
+			return true;
+		if (!isatty(STDIN_FILENO))
+			return false;
+
+		cerr << "An update package (" << _newVersion << ") is available, do you want to download it? [y/N] ";
+		string answer;
+		getline(cin, answer);
+		return answer == "y" || answer == "Y" || answer == "yes";
+	};
+
+	bool onProgress(int64_t dlTotal, int64_t dlNow) override
+	{
+		if (_isVerbose && dlTotal > 0)
+		{
+			int percent = static_cast<int>(dlNow * 100 / dlTotal);
+			if (percent != _lastPercent)
+			{
+				cerr << "\rDownloading: " << percent << " %";
+				if (percent == 100)
+					cerr << endl;
+				_lastPercent = percent;
+			}
+		}
+		return !isInterrupted;
+	};
+
+	bool isPaused() override
+	{
+		// Ctrl+C while paused: resume, so onProgress() aborts
+		bool isPaused = isPauseRequested && !isInterrupted;
+		if (_isVerbose && isPaused != _wasPaused)
+			cerr << (isPaused ? "\nPaused" : "\nResumed") << endl;
+		_wasPaused = isPaused;
+		return isPaused;
+	};
+
+	bool install(const string & packagePath) override
+	{
+		if (_installCmd.empty())
+		{
+			if (_isVerbose)
+				cerr << "Package downloaded: " << packagePath << endl;
+			return true;
+		}
+
+		// The file name comes from the server: it's given to the shell as a positional parameter ($1),
+		// never as part of the command it parses
+		string script = _installCmd + " \"$1\"";
+		pid_t pid = fork();
+		if (pid < 0)
+			return false;
+		if (pid == 0)
+		{
+			execl("/bin/sh", "sh", "-c", script.c_str(), "gupcli", packagePath.c_str(), static_cast<char *>(NULL));
+			_exit(127);
+		}
+
+		int status = 0;
+		while (waitpid(pid, &status, 0) < 0)
+		{
+			if (errno != EINTR)
+				return false;
+		}
+		return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	};
+
+	bool isPublishStopped() override
+	{
+		return isInterrupted != 0;
+	};
+
+	void onError(const string & errMsg) override
+	{
+		if (_isVerbose)
+			cerr << "curl error: " << errMsg << endl;
+	};
+
+private:
+	int _lastPercent = -1;
+	bool _wasPaused = false;
+};
+
+// Runs the update of one product and prints its result, returns the exit code
+static int runProduct(GupEngine & engine, CliCallbacks & callbacks, bool isStats)
+{
+	GupEngineResult result = engine.run(callbacks);
+	const char *resultStr = GupEngine::getResultName(result);
+	if (callbacks._isCheckOnly && result == gupUpdateDeclined)
+		resultStr = "updateAvailable";
+
+	if (isStats)
+	{
+		const GupEngineStats & stats = engine.getStats();
+		const GupTransferTimes & times = stats.checkTimes;
+		const GupTransferTimes & dlTimes = stats.downloadTimes;
+		printf("result=%s cache=%s check=%.6f infoBytes=%lld parse=%.6f http=%s dns=%.6f connect=%.6f tls=%.6f ttfb=%.6f probe=%.6f failovers=%d download=%.6f bytes=%lld delta=%s patch=%.6f dlReused=%s dlConnect=%.6f dlTls=%.6f ready=%s wait=%.6f\n",
+			resultStr, GupEngine::getCacheResultName(stats.infoCacheResult), stats.checkTime, static_cast<long long>(stats.checkBytes), stats.parseTime, times.httpVersion, times.nameLookup, times.connect, times.appConnect, times.startTransfer,
+			stats.mirrorProbeTime, stats.mirrorFailovers, stats.downloadTime, static_cast<long long>(stats.downloadedBytes), stats.isDeltaApplied ? "yes" : "no", stats.patchTime,
+			dlTimes.isReused ? "yes" : "no", dlTimes.connect, dlTimes.appConnect, stats.isPackageReady ? "yes" : "no", stats.downloadWaitTime);
+	}
+	else
+	{
+		cout << resultStr;
+		if (!callbacks._newVersion.empty())
+			cout << " " << callbacks._newVersion;
+		cout << endl;
+	}
+
+	if (callbacks._isVerbose && (result == gupPackageCorrupted || result == gupSignatureInvalid))
+		cerr << engine.getLastError() << endl;
+	if (callbacks._isVerbose && engine.getStats().nextCheckIn > 0)
+		cerr << "Next check in " << engine.getStats().nextCheckIn << " s" << endl;
+	if (callbacks._isVerbose && engine.getStats().isOutOfRollout)
+		cerr << "The update isn't offered to this machine yet" << endl;
+
+	switch (result)
+	{
+		case gupNoUpdate:
+		case gupUpdateDeclined:
+		case gupUpdateInstalled:
+		case gupCheckDeferred:
+			return 0;
+		case gupDownloadAborted:
+			return 3;
+		default:
+			return 1;
+	}
+}
+
+// An update info with what the servers send: mirrors, hash, deltas and hints
+const char BENCH_UPDATE_INFO[] = "<?xml version=\"1.0\"?>\n\
+<GUP>\n\
+	<NeedToBeUpdated>yes</NeedToBeUpdated>\n\
+	<Version>8.6.9</Version>\n\
+	<Location weight=\"3\">https://mirror1.example.org/npp/8.6.9/npp.8.6.9.Installer.x64.exe</Location>\n\
+	<Location weight=\"2\">https://mirror2.example.org/npp/8.6.9/npp.8.6.9.Installer.x64.exe</Location>\n\
+	<Location weight=\"0\">https://github.com/notepad-plus-plus/notepad-plus-plus/releases/download/v8.6.9/npp.8.6.9.Installer.x64.exe</Location>\n\
+	<Hash algo=\"sha256\">0f4d1a9a3c2c5b1e6b0e3e7c9a1f2d4b5c6d7e8f9a0b1c2d3e4f5a6b7c8d9e0f</Hash>\n\
+	<Delta from=\"8.6.8\">\n\
+		<Location>https://mirror1.example.org/npp/8.6.9/npp.8.6.8-8.6.9.x64.delta</Location>\n\
+		<Base>npp.8.6.8.Installer.x64.exe</Base>\n\
+		<Hash algo=\"sha256\">1e2d3c4b5a69788796a5b4c3d2e1f0011223344556677889900aabbccddeeff0</Hash>\n\
+	</Delta>\n\
+	<Delta from=\"8.6.7\">\n\
+		<Location>https://mirror1.example.org/npp/8.6.9/npp.8.6.7-8.6.9.x64.delta</Location>\n\
+		<Base>npp.8.6.7.Installer.x64.exe</Base>\n\
+		<Hash algo=\"sha256\">ffeeddccbbaa00998877665544332211f0e1d2c3b4a5968778695a4b3c2d1e0f</Hash>\n\
+	</Delta>\n\
+	<MinCheckInterval>3600</MinCheckInterval>\n\
+	<Rollout>50</Rollout>\n\
+</GUP>\n";
+
+// Cost of parsing the update info, XML against binary manifest
+static int benchParse(int iterations)
+{
+	string xml = BENCH_UPDATE_INFO;
+	string manifest = GupDownloadInfo(xml).toManifest();
+
+	for (const string * answer : { &xml, &manifest })
+	{
+		size_t mirrorCount = 0;
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i)
+			mirrorCount += GupDownloadInfo(*answer).getMirrors().size();
+		chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+
+		printf("format=%s bytes=%zu parse=%.3fus mirrors=%zu\n", answer == &xml ? "xml" : "binary", answer->size(),
+			elapsed.count() / iterations, mirrorCount / iterations);
+	}
+	return 0;
+}
+
+// Heap in use, in bytes: 0 where it can't be told
+static size_t getHeapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	return mallinfo2().uordblks;
+#else
+	return 0;
+#endif
+}
+
+// Cost of reading the configuration at startup, the way WinGup does: the first load (cold), the next ones,
+// then the first message of nativeLang.xml (read by then) and the memory the configuration keeps
+static int benchStartup(int iterations, const string & configPath, const string & optionsPath, const string & langPath)
+{
+	double cold = 0;
+	double warm = 0;
+	double lang = 0;
+	size_t retained = 0;
+	for (int i = 0; i < iterations; ++i)
+	{
+		size_t heapBefore = getHeapInUse();
+		auto start = chrono::steady_clock::now();
+		GupParameters gupParams(configPath.c_str());
+		GupExtraOptions extraOptions(optionsPath.c_str());
+		GupNativeLang nativeLang(langPath.c_str());
+		chrono::duration<double, micro> load = chrono::steady_clock::now() - start;
+		(i == 0 ? cold : warm) += load.count();
+
+		start = chrono::steady_clock::now();
+		nativeLang.getMessageString("MSGID_UPDATEAVAILABLE");
+		lang += chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+		retained = getHeapInUse() - heapBefore;
+	}
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("cold=%.3fus warm=%.3fus lang=%.3fus retained=%zu peakRss=%ldKB\n", cold, iterations > 1 ? warm / (iterations - 1) : 0.0,
+		lang / iterations, retained, usage.ru_maxrss);
+	return 0;
+}
+
+// A value of the alphabet which trips up command line parsers
+static string randomValue(mt19937 & rng, size_t maxLength)
+{
+	static const char alphabet[] = "ab8.-\\\" \t;:/";
+	string value(rng() % (maxLength + 1), ' ');
+	for (char & c : value)
+		c = alphabet[rng() % (sizeof(alphabet) - 1)];
+	return value;
+}
+
+// The WinGup command line parser (GupCommandLine): fuzzed, then timed
+static int benchCommandLine(int iterations)
+{
+	mt19937 rng(1234);
+	int mismatches = 0;
+	for (int i = 0; i < iterations; ++i)
+	{
+		// Any arguments come back from their quoted form
+		vector<string> args(rng() % 8);
+		string cmdLine;
+		for (string & arg : args)
+		{
+			arg = randomValue(rng, 12);
+			cmdLine += GupCommandLine::quote(arg) + string(1 + rng() % 2, rng() % 2 ? ' ' : '\t');
+		}
+		if (GupCommandLine::split(cmdLine.c_str()) != args)
+		{
+			++mismatches;
+			fprintf(stderr, "split: [%s]\n", cmdLine.c_str());
+		}
+
+		// And so do the options of WinGup, in any order, among unknown flags
+		string version = "8." + randomValue(rng, 6);
+		string customParam = "x" + randomValue(rng, 10);
+		string logPath = "C:\\" + randomValue(rng, 16);
+		long checkTimeout = static_cast<long>(rng() % 100000);
+		vector<string> options = { "-v" + version, "-p" + customParam, "--log", logPath, "--check-timeout", to_string(checkTimeout), "-verbose", "-unknown" };
+		string optionsLine;
+		for (size_t j : { 4, 0, 6, 2, 1, 7 })
+		{
+			optionsLine += GupCommandLine::quote(options[j]) + " ";
+			if (j == 2 || j == 4)
+				optionsLine += GupCommandLine::quote(options[j + 1]) + " ";
+		}
+		GupCommandLine parsed(optionsLine.c_str());
+		if (parsed.version != version || parsed.customParam != customParam || parsed.logPath != logPath
+			|| parsed.checkTimeout != checkTimeout || !parsed.isVerbose || parsed.ignored.size() != 1)
+		{
+			++mismatches;
+			fprintf(stderr, "options: [%s]\n", optionsLine.c_str());
+		}
+
+		// Bytes which make no command line at all only have to be survived
+		string garbage(rng() % 64, ' ');
+		for (char & c : garbage)
+			c = static_cast<char>(1 + rng() % 255);
+		GupCommandLine garbageLine(garbage.c_str());
+	}
+	printf("fuzz=%d mismatches=%d\n", iterations, mismatches);
+
+	// One pass over the command line: the time per byte stays the same however long it is
+	for (size_t argCount : { 16, 256, 4096 })
+	{
+		string cmdLine;
+		for (size_t i = 0; i < argCount; ++i)
+			cmdLine += i % 4 == 0 ? "-c\"C:\\Program Files\\App\\gup.xml;D:\\x\\gup.xml\" " : i % 4 == 1 ? "--log \"C:\\My Logs\\gup.log\" " : i % 4 == 2 ? "-v8.6.9 " : "-px64 ";
+
+		int repeat = static_cast<int>(max<size_t>(1, 200000 / cmdLine.size()));
+		size_t ignored = 0;
+		auto start = chrono::steady_clock::now();
+		for (int i = 0; i < repeat; ++i)
+			ignored += GupCommandLine(cmdLine.c_str()).ignored.size();
+		chrono::duration<double, micro> elapsed = chrono::steady_clock::now() - start;
+
+		printf("bytes=%zu args=%zu parse=%.3fus perByte=%.2fns ignored=%zu\n", cmdLine.size(), argCount, elapsed.count() / repeat,
+			elapsed.count() * 1000 / repeat / cmdLine.size(), ignored / repeat);
+	}
+	return mismatches ? 1 : 0;
+}
+
+// The progress pipeline of WinGup (ProgressChannel): what the thread of the transfer pays for each progress
+// callback, and what the UI, which takes the latest sample at its own pace, gets of them
+static int benchProgress(int durationMs)
+{
+	ProgressChannel channel;
+	atomic<bool> isDone(false);
+	int64_t dlTotal = static_cast<int64_t>(1) << 40;
+	int64_t pushed = 0;
+	int64_t kept = 0;
+	double pushTime = 0;
+
+	thread producer([&]() {
+		auto start = chrono::steady_clock::now();
+		auto end = start + chrono::milliseconds(durationMs);
+		int64_t dlNow = 0;
+		while (chrono::steady_clock::now() < end)
+		{
+			dlNow += 16384;
+			kept += channel.push(dlTotal, dlNow) ? 1 : 0;
+			++pushed;
+		}
+		kept += channel.push(dlTotal, dlTotal) ? 1 : 0;
+		++pushed;
+		pushTime = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+		isDone = true;
+	});
+
+	// Like the timer of the progress dialog
+	int64_t received = 0;
+	int64_t lastNow = -1;
+	bool isOrdered = true;
+	for (;;)
+	{
+		bool wasDone = isDone;
+		int64_t total = 0;
+		int64_t now = 0;
+		if (channel.pop(total, now))
+		{
+			++received;
+			isOrdered = isOrdered && total == dlTotal && now > lastNow;
+			lastNow = now;
+		}
+		// The last sample is pushed before isDone: the pop after it has it
+		if (wasDone)
+			break;
+		this_thread::sleep_for(chrono::milliseconds(1000 / 30));
+	}
+	producer.join();
+
+	printf("pushes=%lld push=%.1fns kept=%lld received=%lld last=%s ordered=%s\n", static_cast<long long>(pushed), pushTime / pushed,
+		static_cast<long long>(kept), static_cast<long long>(received), lastNow == dlTotal ? "yes" : "no", isOrdered ? "yes" : "no");
+	return lastNow == dlTotal && isOrdered ? 0 : 1;
+}
+
+static vector<string> splitList(const string & list)
+{
+	vector<string> items;
+	size_t start = 0;
+	while (start <= list.size())
+	{
+		size_t end = list.find(',', start);
+		if (end == string::npos)
+			end = list.size();
+		items.push_back(list.substr(start, end - start));
+		start = end + 1;
+	}
+	return items;
+}
+
+struct FleetSettings
+{
+	int clientCount = 0;
+	int concurrency = 100;
+	double checksPerSecond = 0;
+	vector<string> versions;
+	vector<string> params;
+	long checkTimeout = -1;
+	long connectTimeout = -1;
+	bool isXmlManifest = false;
+};
+
+// Simulated fleet of machines checking for updates at once (GupEngine::simulateFleet), each client with
+// a version and a param of the lists in turn: what the update server sustains, and how fast it answers
+static int runFleet(const GupParameters & gupParams, const GupExtraOptions & extraOptions, const FleetSettings & settings)
+{
+	vector<GupParameters> clientParams(settings.clientCount, gupParams);
+	vector<unique_ptr<GupEngine>> engines;
+	vector<GupEngine *> fleet;
+	for (int i = 0; i < settings.clientCount; ++i)
+	{
+		GupParameters & params = clientParams[i];
+		if (!settings.versions.empty())
+			params.setCurrentVersion(settings.versions[i % settings.versions.size()].c_str());
+		if (!settings.params.empty())
+			params.setParam(settings.params[i % settings.params.size()].c_str());
+
+		engines.emplace_back(new GupEngine(params, extraOptions));
+		GupEngine & engine = *engines.back();
+		engine.setStateless(true);
+		if (settings.checkTimeout >= 0 || settings.connectTimeout >= 0)
+			engine.setCheckTimeout(settings.checkTimeout >= 0 ? settings.checkTimeout : extraOptions.getCheckTimeout(),
+				settings.connectTimeout >= 0 ? settings.connectTimeout : extraOptions.getCheckConnectTimeout());
+		if (settings.isXmlManifest)
+			engine.setBinaryManifestEnabled(false);
+		fleet.push_back(&engine);
+	}
+
+	auto start = chrono::steady_clock::now();
+	GupEngine::simulateFleet(fleet, settings.concurrency, settings.checksPerSecond);
+	chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+	// What each machine makes of its answer, without asking nor downloading anything
+	map<string, int> outcomes;
+	bool isAllAnswered = true;
+	vector<double> latencies;
+	int64_t bytes = 0;
+	for (GupEngine *engine : fleet)
+	{
+		CliCallbacks callbacks;
+		callbacks._isCheckOnly = true;
+		string outcome;
+		try {
+			GupEngineResult result = engine->run(callbacks);
+			outcome = result == gupUpdateDeclined ? "updateAvailable" : GupEngine::getResultName(result);
+		}
+		catch (const exception &)
+		{
+			outcome = "invalidUpdateInfo";
+		}
+
+		const GupEngineStats & stats = engine->getStats();
+		if (stats.checkError != CURLE_OK)
+			outcome += string(" (") + curl_easy_strerror(static_cast<CURLcode>(stats.checkError)) + ")";
+		else if (stats.checkHttpCode / 100 != 2)
+			outcome += " (HTTP " + to_string(stats.checkHttpCode) + ")";
+		isAllAnswered = isAllAnswered && (outcome == "noUpdate" || outcome == "updateAvailable");
+		++outcomes[outcome];
+
+		latencies.push_back(stats.checkTime);
+		bytes += stats.checkBytes;
+	}
+
+	sort(latencies.begin(), latencies.end());
+	auto percentile = [&latencies](double p) {
+		return latencies.empty() ? 0.0 : latencies[min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+	};
+	printf("clients=%d concurrency=%d time=%.3fs rate=%.1f/s p50=%.6f p90=%.6f p99=%.6f max=%.6f infoBytes=%lld\n",
+		settings.clientCount, settings.concurrency, elapsed.count(), settings.clientCount / elapsed.count(),
+		percentile(0.5), percentile(0.9), percentile(0.99), latencies.empty() ? 0.0 : latencies.back(), static_cast<long long>(bytes));
+	for (const auto & outcome : outcomes)
+		printf("%s: %d\n", outcome.first.c_str(), outcome.second);
+
+	return isAllAnswered ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	vector<string> configPaths;
+	string optionsPath = "gupOptions.xml";
+	string destDir;
+	string cacheDir;
+	bool isCacheDisabled = false;
+	string version;
+	string customParam;
+	string channel;
+	int segmentCount = 0;
+	bool isDeltaDisabled = false;
+	long minSpeed = -1;
+	long minSpeedTime = -1;
+	long checkTimeout = -1;
+	long connectTimeout = -1;
+	bool isLowPriority = false;
+	bool isStats = false;
+	string logPath;
+	long maxRate = -1;
+	bool isBackground = false;
+	bool isForced = false;
+	bool isXmlManifest = false;
+	int prefetchMode = -1;
+	int benchStartupIterations = 0;
+	FleetSettings fleetSettings;
+	CliCallbacks callbacks;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--help")
+		{
+			cout << MSGID_HELP;
+			return 0;
+		}
+		else if (arg == "-verbose")
+			callbacks._isVerbose = true;
+		else if (arg == "--check-only")
+			callbacks._isCheckOnly = true;
+		else if (arg == "--yes")
+			callbacks._assumeYes = true;
+		else if (arg == "--stats")
+			isStats = true;
+		else if (arg == "--config" && hasValue)
+			configPaths.push_back(argv[++i]);
+		else if (arg == "--options" && hasValue)
+			optionsPath = argv[++i];
+		else if (arg == "--dest" && hasValue)
+			destDir = argv[++i];
+		else if (arg == "--cache-dir" && hasValue)
+			cacheDir = argv[++i];
+		else if (arg == "--no-cache")
+			isCacheDisabled = true;
+		else if (arg == "--segments" && hasValue)
+			segmentCount = atoi(argv[++i]);
+		else if (arg == "--no-delta")
+			isDeltaDisabled = true;
+		else if (arg == "--min-speed" && hasValue)
+			minSpeed = atol(argv[++i]);
+		else if (arg == "--min-speed-time" && hasValue)
+			minSpeedTime = atol(argv[++i]);
+		else if (arg == "--check-timeout" && hasValue)
+			checkTimeout = atol(argv[++i]);
+		else if (arg == "--connect-timeout" && hasValue)
+			connectTimeout = atol(argv[++i]);
+		else if (arg == "--low-priority")
+			isLowPriority = true;
+		else if (arg == "--max-rate" && hasValue)
+			maxRate = atol(argv[++i]);
+		else if (arg == "--background")
+			isBackground = true;
+		else if (arg == "--force")
+			isForced = true;
+		else if (arg == "--xml-manifest")
+			isXmlManifest = true;
+		else if (arg == "--prefetch")
+			prefetchMode = gupPrefetchWhileAsking;
+		else if (arg == "--prefetch-only")
+			prefetchMode = gupPrefetchOnly;
+		else if (arg == "--bench-parse" && hasValue)
+		{
+			try {
+				return benchParse(max(atoi(argv[++i]), 1));
+			}
+			catch (const exception & ex)
+			{
+				cerr << "Xml Exception: " << ex.what() << endl;
+				return 1;
+			}
+		}
+		else if (arg == "--bench-progress" && hasValue)
+			return benchProgress(max(atoi(argv[++i]), 1));
+		else if (arg == "--bench-cmdline" && hasValue)
+			return benchCommandLine(max(atoi(argv[++i]), 1));
+		else if (arg == "--bench-startup" && hasValue)
+			benchStartupIterations = max(atoi(argv[++i]), 1);
+		else if (arg == "--fleet" && hasValue)
+			fleetSettings.clientCount = max(atoi(argv[++i]), 1);
+		else if (arg == "--fleet-concurrency" && hasValue)
+			fleetSettings.concurrency = max(atoi(argv[++i]), 1);
+		else if (arg == "--fleet-rate" && hasValue)
+			fleetSettings.checksPerSecond = max(atof(argv[++i]), 0.0);
+		else if (arg == "--fleet-versions" && hasValue)
+			fleetSettings.versions = splitList(argv[++i]);
+		else if (arg == "--fleet-params" && hasValue)
+			fleetSettings.params = splitList(argv[++i]);
+		else if (arg == "--log" && hasValue)
+			logPath = argv[++i];
+		else if (arg == "--install" && hasValue)
+			callbacks._installCmd = argv[++i];
+		else if (arg.compare(0, 2, "-v") == 0 && arg.size() > 2)
+			version = arg.substr(2);
+		else if (arg.compare(0, 2, "-p") == 0 && arg.size() > 2)
+			customParam = arg.substr(2);
+		else if (arg == "--channel" && hasValue)
+			channel = argv[++i];
+		else
+		{
+			cerr << "Unknown argument: " << arg << endl << MSGID_HELP;
+			return 2;
+		}
+	}
+
+	if (configPaths.empty())
+		configPaths.push_back("gup.xml");
+
+	if (benchStartupIterations > 0)
+	{
+		try {
+			return benchStartup(benchStartupIterations, configPaths.front(), optionsPath, "nativeLang.xml");
+		}
+		catch (const exception & ex)
+		{
+			cerr << "Xml Exception: " << ex.what() << endl;
+			return 1;
+		}
+	}
+
+	try {
+		GupExtraOptions extraOptions(optionsPath.c_str());
+
+		if (fleetSettings.clientCount > 0)
+		{
+			GupParameters gupParams(configPaths.front().c_str());
+			if (!version.empty())
+				gupParams.setCurrentVersion(version.c_str());
+			if (!customParam.empty())
+				gupParams.setParam(customParam.c_str());
+			if (!channel.empty())
+				gupParams.setChannel(channel.c_str());
+
+			fleetSettings.checkTimeout = checkTimeout;
+			fleetSettings.connectTimeout = connectTimeout;
+			fleetSettings.isXmlManifest = isXmlManifest;
+			return runFleet(gupParams, extraOptions, fleetSettings);
+		}
+
+		// One engine per gup.xml, all with the settings of the command line
+		vector<unique_ptr<GupParameters>> products;
+		vector<unique_ptr<GupEngine>> engines;
+		vector<GupEngine *> batch;
+		for (const string & configPath : configPaths)
+		{
+			products.emplace_back(new GupParameters(configPath.c_str()));
+			GupParameters & gupParams = *products.back();
+			if (!version.empty())
+				gupParams.setCurrentVersion(version.c_str());
+			if (!customParam.empty())
+				gupParams.setParam(customParam.c_str());
+			if (!channel.empty())
+				gupParams.setChannel(channel.c_str());
+
+			engines.emplace_back(new GupEngine(gupParams, extraOptions));
+			GupEngine & engine = *engines.back();
+			if (!destDir.empty())
+				engine.setDownloadDir(destDir);
+			if (!cacheDir.empty())
+				engine.setCacheDir(cacheDir);
+			if (isCacheDisabled)
+				engine.setInfoCacheEnabled(false);
+			if (segmentCount > 0)
+				engine.setSegmentCount(segmentCount);
+			if (isDeltaDisabled)
+				engine.setDeltaEnabled(false);
+			if (minSpeed >= 0 || minSpeedTime > 0)
+				engine.setMinSpeed(minSpeed >= 0 ? minSpeed * 1024 : extraOptions.getMinSpeed(),
+					minSpeedTime > 0 ? minSpeedTime : extraOptions.getMinSpeedTime());
+			if (checkTimeout >= 0 || connectTimeout >= 0)
+				engine.setCheckTimeout(checkTimeout >= 0 ? checkTimeout : extraOptions.getCheckTimeout(),
+					connectTimeout >= 0 ? connectTimeout : extraOptions.getCheckConnectTimeout());
+			if (isLowPriority)
+				engine.setLowPriority(true);
+			if (!logPath.empty())
+				engine.setLogPath(logPath);
+			if (maxRate >= 0 || isBackground)
+				engine.setBandwidthPolicy(maxRate >= 0 ? static_cast<int64_t>(maxRate) * 1024 : extraOptions.getMaxRate(),
+					isBackground || extraOptions.isBackground());
+			if (isForced)
+				engine.setScheduleEnabled(false);
+			if (isXmlManifest)
+				engine.setBinaryManifestEnabled(false);
+			if (prefetchMode >= 0)
+				engine.setPrefetchMode(static_cast<GupPrefetchMode>(prefetchMode));
+			batch.push_back(&engine);
+		}
+
+		signal(SIGINT, onInterrupt);
+		signal(SIGUSR1, onPauseToggle);
+		if (batch.size() > 1)
+			GupEngine::checkUpdates(batch);
+
+		int exitCode = 0;
+		for (size_t i = 0; i < engines.size(); ++i)
+		{
+			GupEngine & engine = *engines[i];
+			CliCallbacks productCallbacks = callbacks;
+			int productExitCode = 1;
+			if (batch.size() > 1)
+				cout << configPaths[i] << ": ";
+
+			// An update info which can't be parsed only stops its product
+			try {
+				productExitCode = runProduct(engine, productCallbacks, isStats);
+			}
+			catch (const exception & ex)
+			{
+				if (batch.size() > 1)
+					cout << "invalidUpdateInfo" << endl;
+				cerr << "Xml Exception: " << ex.what() << endl;
+			}
+
+			if (exitCode == 0)
+				exitCode = productExitCode;
+		}
+		return exitCode;
+	}
+	catch (const exception & ex)
+	{
+		cerr << "Xml Exception: " << ex.what() << endl;
+		return 1;
+	}
+}
@@ -0,0 +1,280 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <chrono>
+#include "outputFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+
+// CreateFileA fails with INVALID_HANDLE_VALUE, a closed OutputFile has NULL
+static void *toFileHandle(HANDLE hFile)
+{
+	return hFile == INVALID_HANDLE_VALUE ? NULL : hFile;
+}
+
+bool OutputFile::open(const string & path, bool keepContent)
+{
+	close();
+	_hFile = toFileHandle(::CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, keepContent ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+	return _hFile != NULL;
+}
+
+bool OutputFile::openForReading(const string & path)
+{
+	close();
+	_hFile = toFileHandle(::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+	return _hFile != NULL;
+}
+
+bool OutputFile::isOpen() const
+{
+	return _hFile != NULL;
+}
+
+bool OutputFile::writeAt(const void *data, size_t len, int64_t offset)
+{
+	const char *p = static_cast<const char *>(data);
+	while (len > 0)
+	{
+		// WriteFile takes the position from OVERLAPPED even on a synchronous handle
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		DWORD toWrite = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+		DWORD written = 0;
+		if (!::WriteFile(_hFile, p, toWrite, &written, &overlapped) || written == 0)
+			return false;
+
+		p += written;
+		len -= written;
+		offset += written;
+	}
+	return true;
+}
+
+bool OutputFile::readAt(void *data, size_t len, int64_t offset)
+{
+	char *p = static_cast<char *>(data);
+	while (len > 0)
+	{
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+		overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+		DWORD toRead = len > 0x40000000 ? 0x40000000 : static_cast<DWORD>(len);
+		DWORD read = 0;
+		if (!::ReadFile(_hFile, p, toRead, &read, &overlapped) || read == 0)
+			return false;
+
+		p += read;
+		len -= read;
+		offset += read;
+	}
+	return true;
+}
+
+bool OutputFile::truncate(int64_t size)
+{
+	LARGE_INTEGER pos;
+	pos.QuadPart = size;
+	return ::SetFilePointerEx(_hFile, pos, NULL, FILE_BEGIN) && ::SetEndOfFile(_hFile);
+}
+
+bool OutputFile::preallocate(int64_t size)
+{
+	// The allocation size is independent of the end of file
+	FILE_ALLOCATION_INFO allocation;
+	allocation.AllocationSize.QuadPart = size;
+	if (::SetFileInformationByHandle(_hFile, FileAllocationInfo, &allocation, sizeof(allocation)))
+		return true;
+
+	return ::GetLastError() != ERROR_DISK_FULL;
+}
+
+bool OutputFile::close()
+{
+	if (_hFile == NULL)
+		return true;
+
+	bool isOk = ::CloseHandle(_hFile) != FALSE;
+	_hFile = NULL;
+	return isOk;
+}
+
+int64_t OutputFile::getSize(const string & path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!::GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+		return -1;
+
+	return (static_cast<int64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+}
+
+#else
+
+bool OutputFile::open(const string & path, bool keepContent)
+{
+	close();
+	_fd = ::open(path.c_str(), O_RDWR | O_CREAT | (keepContent ? 0 : O_TRUNC), 0644);
+	return _fd != -1;
+}
+
+bool OutputFile::openForReading(const string & path)
+{
+	close();
+	_fd = ::open(path.c_str(), O_RDONLY);
+	return _fd != -1;
+}
+
+bool OutputFile::isOpen() const
+{
+	return _fd != -1;
+}
+
+bool OutputFile::writeAt(const void *data, size_t len, int64_t offset)
+{
+	const char *p = static_cast<const char *>(data);
+	while (len > 0)
+	{
+		ssize_t written = ::pwrite(_fd, p, len, offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return false;
+
+		p += written;
+		len -= written;
+		offset += written;
+	}
+	return true;
+}
+
+bool OutputFile::readAt(void *data, size_t len, int64_t offset)
+{
+	char *p = static_cast<char *>(data);
+	while (len > 0)
+	{
+		ssize_t read = ::pread(_fd, p, len, offset);
+		if (read < 0 && errno == EINTR)
+			continue;
+		if (read <= 0)
+			return false;
+
+		p += read;
+		len -= read;
+		offset += read;
+	}
+	return true;
+}
+
+bool OutputFile::truncate(int64_t size)
+{
+	return ::ftruncate(_fd, size) == 0;
+}
+
+bool OutputFile::preallocate(int64_t size)
+{
+#ifdef __linux__
+	// Unlike posix_fallocate, this doesn't change the file size: what has been received is still what's in the file
+	if (size > 0 && ::fallocate(_fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0)
+		return errno != ENOSPC;
+#else
+	(void)size;
+#endif
+	return true;
+}
+
+bool OutputFile::close()
+{
+	if (_fd == -1)
+		return true;
+
+	bool isOk = ::close(_fd) == 0;
+	_fd = -1;
+	return isOk;
+}
+
+int64_t OutputFile::getSize(const string & path)
+{
+	struct stat st;
+	if (::stat(path.c_str(), &st) != 0)
+		return -1;
+
+	return st.st_size;
+}
+
+#endif
+
+bool CoalescingWriter::write(const void *data, size_t len, int64_t offset)
+{
+	const char *p = static_cast<const char *>(data);
+	while (len > 0)
+	{
+		if (_buffer.empty())
+		{
+			_buffer.reserve(BLOCK_SIZE);
+			_bufferOffset = offset;
+		}
+		else if (offset != _bufferOffset + static_cast<int64_t>(_buffer.size()))
+		{
+			if (!flush())
+				return false;
+			_bufferOffset = offset;
+		}
+
+		// Up to the next block boundary
+		size_t room = BLOCK_SIZE - static_cast<size_t>(offset % BLOCK_SIZE);
+		size_t n = len < room ? len : room;
+		_buffer.insert(_buffer.end(), p, p + n);
+		p += n;
+		len -= n;
+		offset += n;
+
+		if (offset % BLOCK_SIZE == 0 && !flush())
+			return false;
+	}
+	return true;
+}
+
+bool CoalescingWriter::flush()
+{
+	if (_buffer.empty())
+		return true;
+
+	auto start = chrono::steady_clock::now();
+	bool isOk = _file.writeAt(_buffer.data(), _buffer.size(), _bufferOffset);
+	_writeTime += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	_bufferOffset += _buffer.size();
+	_buffer.clear();
+	return isOk;
+}
@@ -0,0 +1,97 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef OUTPUTFILE_H
+#define OUTPUTFILE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Destination of a download which can be written at any offset,
+// so several ranges of the same package can be received at once.
+class OutputFile
+{
+public:
+	OutputFile() {};
+	~OutputFile() { close(); };
+
+	// Create the file, or open it with its current content to resume a download
+	bool open(const std::string & path, bool keepContent = false);
+	// Open an existing file for readAt() only (the base of a delta)
+	bool openForReading(const std::string & path);
+	bool isOpen() const;
+
+	bool writeAt(const void *data, size_t len, int64_t offset);
+	// Read back what has been written, to hash the ranges received out of order
+	bool readAt(void *data, size_t len, int64_t offset);
+	bool truncate(int64_t size);
+
+	// Reserve the disk space of a file of this size, without changing the file size.
+	// Returns false only if the disk is full: where it's not supported, the space is taken while writing.
+	bool preallocate(int64_t size);
+
+	// Returns false if the file couldn't be flushed to disk
+	bool close();
+
+	// -1 if the file doesn't exist
+	static int64_t getSize(const std::string & path);
+
+private:
+#ifdef _WIN32
+	void *_hFile = NULL;  // HANDLE: <windows.h> and its min/max macros stay out of the includers
+#else
+	int _fd = -1;
+#endif
+
+	OutputFile(const OutputFile &) = delete;
+	OutputFile & operator=(const OutputFile &) = delete;
+};
+
+// Coalescing buffer of one sequential writer of an OutputFile.
+// curl hands over 16 KB at a time: they are gathered and written by blocks
+// of BLOCK_SIZE, at offsets aligned on BLOCK_SIZE, which saves most of the system calls.
+// The writes are synchronous, in the thread of the caller: nothing is written until flush()
+// when the block isn't complete.
+class CoalescingWriter
+{
+public:
+	static const size_t BLOCK_SIZE = 1024 * 1024;
+
+	CoalescingWriter(OutputFile & file) : _file(file) {};
+
+	bool write(const void *data, size_t len, int64_t offset);
+	bool flush();
+	// Drop what hasn't been written yet
+	void discard() { _buffer.clear(); };
+
+	// Seconds spent writing to the file
+	double getWriteTime() const { return _writeTime; };
+
+private:
+	OutputFile & _file;
+	std::vector<char> _buffer;
+	int64_t _bufferOffset = 0;
+	double _writeTime = 0;
+
+	CoalescingWriter(const CoalescingWriter &) = delete;
+	CoalescingWriter & operator=(const CoalescingWriter &) = delete;
+};
+
+#endif // OUTPUTFILE_H
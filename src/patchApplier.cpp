@@ -0,0 +1,212 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include "patchApplier.h"
+
+using namespace std;
+
+const char DELTA_MAGIC[] = "GUPDIFF1";
+const size_t DELTA_HEADER_SIZE = 8 + 2 * 8 + 32;
+
+static int64_t readInt64(const unsigned char *p)
+{
+	uint64_t value = 0;
+	for (int i = 7; i >= 0; --i)
+		value = (value << 8) | p[i];
+	return static_cast<int64_t>(value);
+}
+
+PatchApplier::PatchApplier(OutputFile & base, int64_t baseSize, OutputFile & target) : _base(base), _baseSize(baseSize), _target(target), _writer(target)
+{
+	_fieldSize = DELTA_HEADER_SIZE;
+}
+
+bool PatchApplier::fail(const char *error)
+{
+	_error = error;
+	return false;
+}
+
+bool PatchApplier::feed(const void *data, size_t len)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	while (len > 0)
+	{
+		if (_state == stateEnd)
+			return fail("The delta goes on after its end.");
+
+		// Inserted data is written as it comes
+		if (_state == stateInsertData)
+		{
+			size_t n = static_cast<size_t>(min<int64_t>(_insertLeft, len));
+			if (!write(p, n))
+				return false;
+
+			p += n;
+			len -= n;
+			_insertLeft -= n;
+			if (_insertLeft == 0)
+			{
+				_state = stateCommand;
+				_fieldSize = 1;
+			}
+			continue;
+		}
+
+		// Anything else has a fixed size, which may be split between two feeds
+		size_t n = min(_fieldSize - _field.size(), len);
+		_field.insert(_field.end(), p, p + n);
+		p += n;
+		len -= n;
+
+		if (_field.size() == _fieldSize)
+		{
+			if (!parseField())
+				return false;
+			_field.clear();
+		}
+	}
+	return true;
+}
+
+bool PatchApplier::parseField()
+{
+	const unsigned char *p = _field.data();
+	switch (_state)
+	{
+		case stateHeader:
+		{
+			if (memcmp(p, DELTA_MAGIC, 8) != 0)
+				return fail("It's not a valid GUP delta.");
+			if (readInt64(p + 8) != _baseSize)
+				return fail("The delta doesn't apply to this base package.");
+
+			_targetSize = readInt64(p + 16);
+			if (_targetSize < 0)
+				return fail("The target size of the delta is incorrect.");
+			if (!_target.preallocate(_targetSize))
+				return fail("Not enough disk space for the package.");
+
+			static const char hexDigits[] = "0123456789abcdef";
+			for (int i = 0; i < 32; ++i)
+			{
+				_expectedSha256 += hexDigits[p[24 + i] >> 4];
+				_expectedSha256 += hexDigits[p[24 + i] & 0xF];
+			}
+			_state = stateCommand;
+			_fieldSize = 1;
+			return true;
+		}
+
+		case stateCommand:
+		{
+			if (p[0] == 'C')
+			{
+				_state = stateCopy;
+				_fieldSize = 16;
+			}
+			else if (p[0] == 'I')
+			{
+				_state = stateInsertLength;
+				_fieldSize = 8;
+			}
+			else if (p[0] == 'E')
+			{
+				if (_written != _targetSize)
+					return fail("The delta ends before the target is complete.");
+				if (!_writer.flush())
+					return fail("Cannot write the package.");
+				_state = stateEnd;
+			}
+			else
+			{
+				return fail("Unknown command in the delta.");
+			}
+			return true;
+		}
+
+		case stateCopy:
+		{
+			int64_t offset = readInt64(p);
+			int64_t len = readInt64(p + 8);
+			if (offset < 0 || len < 0 || len > _baseSize - offset)
+				return fail("The delta copies beyond the base package.");
+			if (!copy(offset, len))
+				return false;
+
+			_state = stateCommand;
+			_fieldSize = 1;
+			return true;
+		}
+
+		case stateInsertLength:
+		{
+			_insertLeft = readInt64(p);
+			if (_insertLeft < 0)
+				return fail("The delta inserts a negative length.");
+
+			_state = _insertLeft > 0 ? stateInsertData : stateCommand;
+			_fieldSize = 1;
+			return true;
+		}
+
+		default:
+			return fail("Unexpected state of the delta.");
+	}
+}
+
+bool PatchApplier::write(const void *data, size_t len)
+{
+	if (static_cast<int64_t>(len) > _targetSize - _written)
+		return fail("The delta writes beyond the target size.");
+	if (!_writer.write(data, len, _written))
+		return fail("Cannot write the package.");
+
+	// Hashed as it is rebuilt, like a downloaded package
+	_hash.update(data, len);
+	_written += len;
+	return true;
+}
+
+bool PatchApplier::copy(int64_t offset, int64_t len)
+{
+	if (_copyBuffer.empty())
+		_copyBuffer.resize(256 * 1024);
+
+	while (len > 0)
+	{
+		size_t n = static_cast<size_t>(min<int64_t>(len, _copyBuffer.size()));
+		if (!_base.readAt(_copyBuffer.data(), n, offset))
+			return fail("Cannot read the base package.");
+		if (!write(_copyBuffer.data(), n))
+			return false;
+
+		offset += n;
+		len -= n;
+	}
+	return true;
+}
+
+string PatchApplier::getTargetSha256()
+{
+	Sha256 hash = _hash;
+	return hash.finish();
+}
@@ -0,0 +1,87 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PATCHAPPLIER_H
+#define PATCHAPPLIER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "outputFile.h"
+#include "sha256.h"
+
+//
+// Rebuilds a package from the package of the previous version (the base) and a delta.
+// The delta is pushed as it comes (feed), so it can be applied straight from the network
+// or read from disk by chunks: the memory used doesn't depend on the package size.
+//
+// Delta format (integers are 64 bits little endian):
+//
+//   "GUPDIFF1"
+//   base size, target size, SHA-256 of the target (32 bytes)
+//   then commands, up to the target size:
+//     'C' offset length    copy length bytes of the base from offset
+//     'I' length data      insert the length bytes which follow
+//     'E'                  end of the delta
+//
+// linux/makeDelta.py makes such deltas.
+//
+class PatchApplier
+{
+public:
+	// The target is written from offset 0, sequentially
+	PatchApplier(OutputFile & base, int64_t baseSize, OutputFile & target);
+
+	bool feed(const void *data, size_t len);
+	bool isComplete() const { return _state == stateEnd; };
+
+	int64_t getTargetSize() const { return _targetSize; };
+	// Both are lowercase hexadecimal, the first one is what the delta announces
+	const std::string & getExpectedSha256() const { return _expectedSha256; };
+	std::string getTargetSha256();
+
+	const std::string & getError() const { return _error; };
+
+private:
+	enum State { stateHeader, stateCommand, stateCopy, stateInsertLength, stateInsertData, stateEnd };
+
+	OutputFile & _base;
+	int64_t _baseSize;
+	OutputFile & _target;
+	CoalescingWriter _writer;
+
+	State _state = stateHeader;
+	std::vector<unsigned char> _field;  // fixed size part being received
+	size_t _fieldSize = 0;
+	int64_t _insertLeft = 0;
+
+	int64_t _targetSize = -1;
+	int64_t _written = 0;
+	Sha256 _hash;
+	std::vector<char> _copyBuffer;
+	std::string _expectedSha256;
+	std::string _error;
+
+	bool parseField();
+	bool write(const void *data, size_t len);
+	bool copy(int64_t offset, int64_t len);
+	bool fail(const char *error);
+};
+
+#endif // PATCHAPPLIER_H
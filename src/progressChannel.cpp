@@ -0,0 +1,59 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "progressChannel.h"
+
+using namespace std;
+
+const unsigned FRESH_SLOT = 4;
+const unsigned SLOT_INDEX = 3;
+
+ProgressChannel::ProgressChannel(int maxRate) : _shared(0)
+{
+	_minInterval = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(maxRate > 0 ? 1.0 / maxRate : 0));
+}
+
+bool ProgressChannel::push(int64_t dlTotal, int64_t dlNow)
+{
+	auto now = chrono::steady_clock::now();
+	bool isBoundary = dlNow == 0 || dlNow == dlTotal;
+	if (_hasPushed && !isBoundary && now - _lastPush < _minInterval)
+		return false;
+	_hasPushed = true;
+	_lastPush = now;
+
+	Sample & sample = _slots[_produced];
+	sample.dlTotal = dlTotal;
+	sample.dlNow = dlNow;
+
+	// Release: the consumer who takes the slot sees the sample. Acquire: the slot given back is done with
+	_produced = _shared.exchange(_produced | FRESH_SLOT, memory_order_acq_rel) & SLOT_INDEX;
+	return true;
+}
+
+bool ProgressChannel::pop(int64_t & dlTotal, int64_t & dlNow)
+{
+	if (!(_shared.load(memory_order_relaxed) & FRESH_SLOT))
+		return false;
+
+	_consumed = _shared.exchange(_consumed, memory_order_acq_rel) & SLOT_INDEX;
+	dlTotal = _slots[_consumed].dlTotal;
+	dlNow = _slots[_consumed].dlNow;
+	return true;
+}
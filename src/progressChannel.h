@@ -0,0 +1,64 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROGRESSCHANNEL_H
+#define PROGRESSCHANNEL_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+//
+// Progress of a download, from the thread of the transfer to the thread of the UI, without a lock or a wait
+// on either side: the transfer never waits for the UI to repaint, and the UI never waits for curl.
+//
+// Only the latest sample matters, so the channel is a triple buffer rather than a queue: the producer fills
+// its slot then swaps it with the shared one, the consumer swaps the shared one with its own when it's fresh.
+// Neither can be full nor stale, whatever the pace of the other side.
+//
+class ProgressChannel
+{
+public:
+	// The samples closer than 1/maxRate seconds to the previous one are dropped by push(), except the first
+	// and the last one of a download (dlNow is 0 or dlTotal): they reset and complete the progress
+	explicit ProgressChannel(int maxRate = 30);
+
+	// Thread of the transfer, like GupEngineCallbacks::onProgress(). False if the sample has been dropped
+	bool push(int64_t dlTotal, int64_t dlNow);
+
+	// Thread of the UI: the latest sample, false if there's none since the previous call
+	bool pop(int64_t & dlTotal, int64_t & dlNow);
+
+private:
+	struct Sample {
+		int64_t dlTotal = 0;
+		int64_t dlNow = 0;
+	};
+
+	Sample _slots[3];
+	std::atomic<unsigned> _shared;  // index of the slot between the two threads, with FRESH_SLOT once pushed
+	unsigned _produced = 1;         // slots of the producer and of the consumer
+	unsigned _consumed = 2;
+
+	std::chrono::steady_clock::duration _minInterval;
+	std::chrono::steady_clock::time_point _lastPush;
+	bool _hasPushed = false;
+};
+
+#endif // PROGRESSCHANNEL_H
@@ -0,0 +1,169 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "sha256.h"
+
+using namespace std;
+
+static const uint32_t K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+void Sha256::reset()
+{
+	static const uint32_t init[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(_h, init, sizeof(_h));
+	_length = 0;
+}
+
+void Sha256::transform(const unsigned char *block)
+{
+	uint32_t w[64];
+	for (int i = 0; i < 16; ++i)
+		w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) | (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+
+	for (int i = 16; i < 64; ++i)
+	{
+		uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a = _h[0], b = _h[1], c = _h[2], d = _h[3], e = _h[4], f = _h[5], g = _h[6], h = _h[7];
+	for (int i = 0; i < 64; ++i)
+	{
+		uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	_h[0] += a; _h[1] += b; _h[2] += c; _h[3] += d;
+	_h[4] += e; _h[5] += f; _h[6] += g; _h[7] += h;
+}
+
+void Sha256::update(const void *data, size_t len)
+{
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+	size_t pending = static_cast<size_t>(_length % 64);
+	_length += len;
+
+	if (pending)
+	{
+		size_t toCopy = 64 - pending < len ? 64 - pending : len;
+		memcpy(_block + pending, p, toCopy);
+		p += toCopy;
+		len -= toCopy;
+		if (pending + toCopy < 64)
+			return;
+		transform(_block);
+	}
+
+	for (; len >= 64; p += 64, len -= 64)
+		transform(p);
+
+	if (len)
+		memcpy(_block, p, len);
+}
+
+string Sha256::finish()
+{
+	uint64_t bitLength = _length * 8;
+	unsigned char padding[72] = { 0x80 };
+	size_t padLen = (_length % 64 < 56) ? 56 - _length % 64 : 120 - _length % 64;
+	for (int i = 0; i < 8; ++i)
+		padding[padLen + i] = static_cast<unsigned char>(bitLength >> (56 - i * 8));
+	update(padding, padLen + 8);
+
+	static const char hexDigits[] = "0123456789abcdef";
+	string digest;
+	for (int i = 0; i < 8; ++i)
+	{
+		for (int shift = 28; shift >= 0; shift -= 4)
+			digest += hexDigits[(_h[i] >> shift) & 0xF];
+	}
+	return digest;
+}
+
+string Sha256::saveState() const
+{
+	// h0..h7, length, then the pending bytes
+	char buf[32];
+	string state;
+	for (int i = 0; i < 8; ++i)
+	{
+		snprintf(buf, sizeof(buf), "%08x", _h[i]);
+		state += buf;
+	}
+	snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(_length));
+	state += buf;
+	for (size_t i = 0; i < _length % 64; ++i)
+	{
+		snprintf(buf, sizeof(buf), "%02x", _block[i]);
+		state += buf;
+	}
+	return state;
+}
+
+bool Sha256::loadState(const string & state)
+{
+	if (state.size() < 80 || state.find_first_not_of("0123456789abcdefABCDEF") != string::npos)
+		return false;
+
+	uint64_t length = strtoull(state.substr(64, 16).c_str(), NULL, 16);
+	if (state.size() != 80 + (length % 64) * 2)
+		return false;
+
+	for (int i = 0; i < 8; ++i)
+		_h[i] = static_cast<uint32_t>(strtoul(state.substr(i * 8, 8).c_str(), NULL, 16));
+	_length = length;
+	for (size_t i = 0; i < length % 64; ++i)
+		_block[i] = static_cast<unsigned char>(strtoul(state.substr(80 + i * 2, 2).c_str(), NULL, 16));
+	return true;
+}
+
+string Sha256::hash(const void *data, size_t len)
+{
+	Sha256 sha;
+	sha.update(data, len);
+	return sha.finish();
+}
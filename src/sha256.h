@@ -0,0 +1,55 @@
+/*
+ Copyright 2007 Don HO <don.h@free.fr>
+
+ This file is part of GUP.
+
+ GUP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU Lesser General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ GUP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public License
+ along with GUP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <string>
+
+// SHA-256 computed incrementally, so a package can be hashed while it is received.
+// The intermediate state can be saved and restored to resume a download without rehashing it.
+class Sha256
+{
+public:
+	Sha256() { reset(); };
+
+	void reset();
+	void update(const void *data, size_t len);
+
+	// Lowercase hexadecimal digest. The object must be reset() before reusing it
+	std::string finish();
+
+	uint64_t getLength() const { return _length; };
+
+	// Hexadecimal dump of the intermediate state
+	std::string saveState() const;
+	bool loadState(const std::string & state);
+
+	static std::string hash(const void *data, size_t len);
+
+private:
+	uint32_t _h[8];
+	uint64_t _length;          // bytes hashed so far
+	unsigned char _block[64];  // pending bytes: _length % 64 of them
+
+	void transform(const unsigned char *block);
+};
+
+#endif // SHA256_H
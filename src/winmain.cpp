@@ -19,13 +19,17 @@
 
 #include <stdint.h>
 #include <windows.h>
+#include <atomic>
 #include <string>
+#include <memory>
+#include <vector>
 #include <commctrl.h>
 #include "resource.h"
 #include <shlwapi.h>
 #include "xmlTools.h"
-#define CURL_STATICLIB
-#include "../curl/include/curl/curl.h"
+#include "gupEngine.h"
+#include "commandLine.h"
+#include "progressChannel.h"
 
 using namespace std;
 
@@ -33,30 +37,35 @@ HINSTANCE hInst;
 HHOOK g_hMsgBoxHook;
 static HWND hProgressDlg;
 static HWND hProgressBar;
-static bool doAbort = false;
-static bool stopDL = false;
+// Between the thread of the download and the one of the progress dialog, which never wait for each other
+static ProgressChannel progressChannel;
+static atomic<bool> doAbort(false);
+static atomic<bool> stopDL(false);          // the user is asked whether to abort: the download is paused
+static atomic<bool> isProgressDlgDone(false);
 static string msgBoxTitle = "";
 static string abortOrNot = "";
 static string proxySrv = "0.0.0.0";
 static long proxyPort  = 0;
-static string winGupUserAgent = "WinGup/";
 static string dlFileName = "";
 static string appIconFile = "";
 
-const char FLAG_OPTIONS[] = "-options";
-const char FLAG_VERBOSE[] = "-verbose";
-const char FLAG_HELP[] = "--help";
+// The progress dialog shows the latest progress at this pace, whatever the pace of the download
+const UINT_PTR PROGRESS_TIMER = 1;
+const UINT PROGRESS_REFRESH = 1000 / 30;
 
 const char MSGID_NOUPDATE[] = "No update is available.";
 const char MSGID_UPDATEAVAILABLE[] = "An update package is available, do you want to download it?";
 const char MSGID_DOWNLOADSTOPPED[] = "Download is stopped by user. Update is aborted.";
 const char MSGID_CLOSEAPP[] = " is opened.\rUpdater will close it in order to process the installation.\rContinue?";
 const char MSGID_ABORTORNOT[] = "Do you want to abort update download?";
+const char MSGID_PACKAGECORRUPTED[] = "The downloaded package is corrupted. Update is aborted.";
+const char MSGID_SIGNATUREINVALID[] = "The update isn't signed by the publisher. Update is aborted.";
 const char MSGID_HELP[] = "Usage :\r\
 \r\
 gup --help\r\
 gup -options\r\
-gup [-verbose] [-vVERSION_VALUE] [-pCUSTOM_PARAM]\r\
+gup [-verbose] [-vVERSION_VALUE] [-pCUSTOM_PARAM] [PERFORMANCE_OPTIONS]\r\
+gup [-verbose] -cCONFIG_LIST [PERFORMANCE_OPTIONS]\r\
 \r\
     --help : Show this help message (and quit program).\r\
     -options : Show the proxy configuration dialog (and quit program).\r\
@@ -67,7 +76,17 @@ gup [-verbose] [-vVERSION_VALUE] [-pCUSTOM_PARAM]\r\
 	-p : Launch GUP with CUSTOM_PARAM.\r\
 	     CUSTOM_PARAM will pass to destination by using GET method\r\
          with argument name \"param\"\r\
-    -verbose : Show error/warning message if any.";
+    -verbose : Show error/warning message if any.\r\
+    -c : Update several programs at once, CONFIG_LIST being the paths of their gup.xml\r\
+         separated by ';'. Their update checks share the connections to the update server.\r\
+\r\
+    Values with blanks are quoted: -p\"x64 portable\", --log \"C:\\My Logs\\gup.log\".\r\
+    PERFORMANCE_OPTIONS (override gupOptions.xml):\r\
+    --check-timeout MS : Time budget of the update check in milliseconds.\r\
+    --connect-timeout MS : Part of this budget given to the connection, in milliseconds.\r\
+    --segments N : Download the package with N parallel ranges.\r\
+    --cache-dir DIR : Directory of the update check cache.\r\
+    --log FILE : Append the result and the timings of every phase to FILE, as a line of JSON.";
 
 std::string thirdDoUpdateDlgButtonLabel;
 
@@ -117,106 +136,6 @@ public:
 };
 CUXHelper uxHelper;
 
-static bool isInList(const char *token2Find, char *list2Clean) {
-	char word[1024];
-	bool isFileNamePart = false;
-
-	for (int i = 0, j = 0 ;  i <= int(strlen(list2Clean)) ; i++)
-	{
-		if ((list2Clean[i] == ' ') || (list2Clean[i] == '\0'))
-		{
-			if ((j) && (!isFileNamePart))
-			{
-				word[j] = '\0';
-				j = 0;
-				bool bingo = !strcmp(token2Find, word);
-
-				if (bingo)
-				{
-					int wordLen = int(strlen(word));
-					int prevPos = i - wordLen;
-
-					for (i = i + 1 ;  i <= int(strlen(list2Clean)) ; i++, prevPos++)
-						list2Clean[prevPos] = list2Clean[i];
-
-					list2Clean[prevPos] = '\0';
-					
-					return true;
-				}
-			}
-		}
-		else if (list2Clean[i] == '"')
-		{
-			isFileNamePart = !isFileNamePart;
-		}
-		else
-		{
-			word[j++] = list2Clean[i];
-		}
-	}
-	return false;
-};
-
-static string getParamVal(char c, char *list2Clean) {
-	char word[1024];
-	bool checkDash = true;
-	bool checkCh = false;
-	bool action = false;
-	bool isFileNamePart = false;
-	int pos2Erase = 0;
-
-	for (int i = 0, j = 0 ;  i <= int(strlen(list2Clean)) ; i++)
-	{
-		if ((list2Clean[i] == ' ') || (list2Clean[i] == '\0'))
-		{
-			if (action)
-			{
-				word[j] = '\0';
-				j = 0;
-				action = false;
-
-				for (i = i + 1 ;  i <= int(strlen(list2Clean)) ; i++, pos2Erase++)
-					list2Clean[pos2Erase] = list2Clean[i];
-						
-				list2Clean[pos2Erase] = '\0';
-
-				return word;
-			}
-			checkDash = true;
-		}
-		else if (list2Clean[i] == '"')
-		{
-			isFileNamePart = !isFileNamePart;
-		}
-
-		if (!isFileNamePart)
-		{
-			if (action)
-			{
-				word[j++] =  list2Clean[i];
-			}
-			else if (checkDash)
-			{
-				if (list2Clean[i] == '-')
-					checkCh = true;
-			            
-				if (list2Clean[i] != ' ')
-					checkDash = false;
-			}
-			else if (checkCh)
-			{
-				if (list2Clean[i] == c)
-				{
-					action = true;
-					pos2Erase = i-1;
-				}
-				checkCh = false;
-			}
-		}
-	}
-	return "";
-};
-
 static void goToScreenCenter(HWND hwnd)
 {
     RECT screenRc;
@@ -235,68 +154,6 @@ static void goToScreenCenter(HWND hwnd)
 };
 
 
-// This is the getUpdateInfo call back function used by curl
-static size_t getUpdateInfoCallback(char *data, size_t size, size_t nmemb, std::string *updateInfo)
-{
-	// What we will return
-	size_t len = size * nmemb;
-	
-	// Is there anything in the buffer?
-	if (updateInfo != NULL)
-	{
-		// Append the data to the buffer
-		updateInfo->append(data, len);
-	}
-
-	return len;
-}
-
-static size_t getDownloadData(unsigned char *data, size_t size, size_t nmemb, FILE *fp)
-{
-	if (doAbort)
-		return 0;
-
-	size_t len = size * nmemb;
-	fwrite(data, len, 1, fp);
-	return len;
-};
-
-static size_t ratio = 0;
-
-static size_t setProgress(HWND, double t, double d, double, double)
-{
-	// Once downloading is finish (100%) close the progress bar dialog
-	// as there is no need to keep it opened because
-	// new dailog asking to close the app will appear (if specified classname in configuration)
-	static bool isDialogClosed = false;
-	if (!isDialogClosed)
-	{
-		while (stopDL)
-			::Sleep(1000);
-		size_t step = size_t(d * 100.0 / t - ratio);
-
-		// Looks like sometime curl is not giving proper data, so workaround
-		// Issue has been reported for Notepad++ (#4666 and #4069)
-		size_t ratioTemp = size_t(d * 100.0 / t);
-		if (ratioTemp <= 100)
-			ratio = ratioTemp;
-
-		SendMessage(hProgressBar, PBM_SETSTEP, (WPARAM)step, 0);
-		SendMessage(hProgressBar, PBM_STEPIT, 0, 0);
-
-		char percentage[128];
-		sprintf(percentage, "Downloading %s: %Iu %%", dlFileName.c_str(), ratio);
-		::SetWindowTextA(hProgressDlg, percentage);
-
-		if (ratio == 100)
-		{
-			SendMessage(hProgressDlg, WM_COMMAND, IDOK, 0);
-			isDialogClosed = true;
-		}
-	}
-	return 0;
-};
-
 LRESULT CALLBACK progressBarDlgProc(HWND hWndDlg, UINT Msg, WPARAM wParam, LPARAM )
 {
 	INITCOMMONCONTROLSEX InitCtrlEx;
@@ -313,11 +170,42 @@ LRESULT CALLBACK progressBarDlgProc(HWND hWndDlg, UINT Msg, WPARAM wParam, LPARA
 										  20, 20, 280, 17,
 										  hWndDlg, NULL, hInst, NULL);
 			SendMessage(hProgressBar, PBM_SETRANGE, 0, MAKELPARAM(0, 100)); 
-			SendMessage(hProgressBar, PBM_SETSTEP, 1, 0);
 			CUXHelper::setIcon(hProgressDlg, appIconFile);
 			goToScreenCenter(hWndDlg);
+			::SetTimer(hWndDlg, PROGRESS_TIMER, PROGRESS_REFRESH, NULL);
 			return TRUE; 
 
+		case WM_TIMER:
+		{
+			// Nothing moves while the user is asked whether to abort
+			int64_t dlTotal = 0;
+			int64_t dlNow = 0;
+			if (wParam != PROGRESS_TIMER || stopDL || !progressChannel.pop(dlTotal, dlNow))
+				return TRUE;
+
+			// Looks like sometime curl is not giving proper data, so workaround
+			// Issue has been reported for Notepad++ (#4666 and #4069)
+			size_t ratio = dlTotal > 0 ? static_cast<size_t>(dlNow * 100 / dlTotal) : 0;
+			if (ratio > 100)
+				return TRUE;
+
+			SendMessage(hProgressBar, PBM_SETPOS, static_cast<WPARAM>(ratio), 0);
+			char percentage[128];
+			snprintf(percentage, sizeof(percentage), "Downloading %s: %Iu %%", dlFileName.c_str(), ratio);
+			::SetWindowTextA(hProgressDlg, percentage);
+
+			// Once downloading is finish (100%) close the progress bar dialog
+			// as there is no need to keep it opened because
+			// new dailog asking to close the app will appear (if specified classname in configuration)
+			if (ratio == 100)
+			{
+				isProgressDlgDone = true;
+				::KillTimer(hWndDlg, PROGRESS_TIMER);
+				EndDialog(hWndDlg, 0);
+			}
+			return TRUE;
+		}
+
 		case WM_COMMAND:
 			switch(wParam)
 			{
@@ -325,6 +213,7 @@ LRESULT CALLBACK progressBarDlgProc(HWND hWndDlg, UINT Msg, WPARAM wParam, LPARA
 				EndDialog(hWndDlg, 0);
 				return TRUE;
 			case IDCANCEL:
+				// The download is paused by curl meanwhile (isPaused()): its connection is kept, and its thread free
 				stopDL = true;
 				if (abortOrNot == "")
 					abortOrNot = MSGID_ABORTORNOT;
@@ -332,6 +221,8 @@ LRESULT CALLBACK progressBarDlgProc(HWND hWndDlg, UINT Msg, WPARAM wParam, LPARA
 				if (abortAnswer == IDYES)
 				{
 					doAbort = true;
+					isProgressDlgDone = true;
+					::KillTimer(hWndDlg, PROGRESS_TIMER);
 					EndDialog(hWndDlg, 0);
 				}
 				stopDL = false;
@@ -419,171 +310,282 @@ static DWORD WINAPI launchProgressBar(void *)
 	return 0;
 }
 
-bool downloadBinary(string urlFrom, string destTo, pair<string, int> proxyServerInfo, bool isSilentMode, pair<string, string> stoppedMessage)
+bool runInstaller(const string& app2runPath, const string& binWindowsClassName, const string& closeMsg, const string& closeMsgTitle)
 {
-	FILE* pFile = fopen(destTo.c_str(), "wb");
 
-	//  Download the install package from indicated location
-	char errorBuffer[CURL_ERROR_SIZE] = { 0 };
-	CURLcode res = CURLE_FAILED_INIT;
-	CURL* curl = curl_easy_init();
-	if (curl)
+	if (!binWindowsClassName.empty())
 	{
-		curl_easy_setopt(curl, CURLOPT_URL, urlFrom.c_str());
-		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, TRUE);
-
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, getDownloadData);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, pFile);
+		HWND h = ::FindWindowExA(NULL, NULL, binWindowsClassName.c_str(), NULL);
 
-		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, FALSE);
-		curl_easy_setopt(curl, CURLOPT_PROGRESSFUNCTION, setProgress);
-		curl_easy_setopt(curl, CURLOPT_PROGRESSDATA, hProgressBar);
+		if (h)
+		{
+			int installAnswer = ::MessageBoxA(NULL, closeMsg.c_str(), closeMsgTitle.c_str(), MB_YESNO);
 
-		curl_easy_setopt(curl, CURLOPT_USERAGENT, winGupUserAgent.c_str());
-		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
+			if (installAnswer == IDNO)
+			{
+				return 0;
+			}
+		}
 
-		if (!proxyServerInfo.first.empty() && proxyServerInfo.second != -1)
+		// kill all process of binary needs to be updated.
+		while (h)
 		{
-			curl_easy_setopt(curl, CURLOPT_PROXY, proxyServerInfo.first.c_str());
-			curl_easy_setopt(curl, CURLOPT_PROXYPORT, proxyServerInfo.second);
+			::SendMessage(h, WM_CLOSE, 0, 0);
+			h = ::FindWindowExA(NULL, NULL, binWindowsClassName.c_str(), NULL);
 		}
-		curl_easy_setopt(curl, CURLOPT_SSL_OPTIONS, CURLSSLOPT_ALLOW_BEAST | CURLSSLOPT_NO_REVOKE);
-
-		res = curl_easy_perform(curl);
-
-		curl_easy_cleanup(curl);
 	}
 
-	if (res != CURLE_OK)
+	// execute the installer
+	HINSTANCE result = ::ShellExecuteA(NULL, "open", app2runPath.c_str(), "", ".", SW_SHOW);
+
+	if (result <= (HINSTANCE)32) // There's a problem (Don't ask me why, ask Microsoft)
 	{
-		if (!isSilentMode && doAbort == false)
-			::MessageBoxA(NULL, errorBuffer, "curl error", MB_OK);
-		if (doAbort)
-		{
-			::MessageBoxA(NULL, stoppedMessage.first.c_str(), stoppedMessage.second.c_str(), MB_OK);
-		}
-		doAbort = false;
 		return false;
 	}
 
-	fflush(pFile);
-	fclose(pFile);
-
 	return true;
 }
 
-bool getUpdateInfo(string &info2get, const GupParameters& gupParams, const GupExtraOptions& proxyServer, const string& customParam, const string& version)
+class WinGupCallbacks : public GupEngineCallbacks
 {
-	char errorBuffer[CURL_ERROR_SIZE] = { 0 };
-
-	// Check on the web the availibility of update
-	// Get the update package's location
-	CURL *curl;
-	CURLcode res = CURLE_FAILED_INIT;
+public:
+	WinGupCallbacks(const GupParameters & gupParams, GupNativeLang & nativeLang) : _gupParams(gupParams), _nativeLang(nativeLang) {};
 
-	curl = curl_easy_init();
-	if (curl)
+	bool askToDownload(const GupDownloadInfo &) override
 	{
-		std::string urlComplete = gupParams.getInfoLocation() + "?version=";
-		if (!version.empty())
-			urlComplete += version;
+		// Ask user if he/she want to do update
+		string updateAvailable = _nativeLang.getMessageString("MSGID_UPDATEAVAILABLE");
+		if (updateAvailable == "")
+			updateAvailable = MSGID_UPDATEAVAILABLE;
+
+		int thirdButtonCmd = _gupParams.get3rdButtonCmd();
+		thirdDoUpdateDlgButtonLabel = _gupParams.get3rdButtonLabel();
+
+		int dlAnswer = 0;
+		HWND hApp = ::FindWindowExA(NULL, NULL, _gupParams.getClassName().c_str(), NULL);
+		bool isModal = _gupParams.isMessageBoxModal();
+
+		if (!thirdButtonCmd)
+			dlAnswer = ::MessageBoxA(isModal ? hApp : NULL, updateAvailable.c_str(), _gupParams.getMessageBoxTitle().c_str(), MB_YESNO);
 		else
-			urlComplete += gupParams.getCurrentVersion();
+			dlAnswer = static_cast<int32_t>(::DialogBox(hInst, MAKEINTRESOURCE(IDD_YESNONEVERDLG), isModal ? hApp : NULL, reinterpret_cast<DLGPROC>(yesNoNeverDlgProc)));
 
-		if (!customParam.empty())
-		{
-			string customParamPost = "&param=";
-			customParamPost += customParam;
-			urlComplete += customParamPost;
-		}
-		else if (!gupParams.getParam().empty())
+		if (dlAnswer == IDCANCEL)
 		{
-			string customParamPost = "&param=";
-			customParamPost += gupParams.getParam();
-			urlComplete += customParamPost;
+			if (_gupParams.getClassName() != "")
+			{
+				if (hApp)
+				{
+					::SendMessage(hApp, thirdButtonCmd, _gupParams.get3rdButtonWparam(), _gupParams.get3rdButtonLparam());
+				}
+			}
 		}
 
-		curl_easy_setopt(curl, CURLOPT_URL, urlComplete.c_str());
+		return dlAnswer == IDYES;
+	};
 
+	void onDownloadStart(const string & packagePath) override
+	{
+		// The progress bar can ask it, nativeLang.xml isn't read before a message is shown
+		abortOrNot = _nativeLang.getMessageString("MSGID_ABORTORNOT");
+		dlFileName = ::PathFindFileNameA(packagePath.c_str());
 
-		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, TRUE);
+		// The full package after a delta which didn't work out: reuse the progress bar if it's still opened
+		progressChannel.push(0, 0);
+		if (_isDialogStarted && !isProgressDlgDone)
+			return;
 
-		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, getUpdateInfoCallback);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &info2get);
+		_isDialogStarted = true;
+		isProgressDlgDone = false;
+		::CreateThread(NULL, 0, launchProgressBar, NULL, 0, NULL);
+	};
 
-		string ua = gupParams.getSoftwareName();
+	bool onProgress(int64_t dlTotal, int64_t dlNow) override
+	{
+		// The dialog takes it when it refreshes: no message sent to it from here, nor any wait
+		progressChannel.push(dlTotal, dlNow);
+		return !doAbort;
+	};
 
-		winGupUserAgent += VERSION_VALUE;
-		if (ua != "")
-		{
-			ua += "/";
-			ua += version;
-			ua += " (";
-			ua += winGupUserAgent;
-			ua += ")";
+	bool isPaused() override
+	{
+		return stopDL;
+	};
+
+	bool install(const string & packagePath) override
+	{
+		string msg = _gupParams.getClassName();
+		string closeApp = _nativeLang.getMessageString("MSGID_CLOSEAPP");
+		if (closeApp == "")
+			closeApp = MSGID_CLOSEAPP;
+		msg += closeApp;
 
-			winGupUserAgent = ua;
+		return runInstaller(packagePath, _gupParams.getClassName(), msg, _gupParams.getMessageBoxTitle().c_str());
+	};
+
+	void onError(const string & errMsg) override
+	{
+		if (!_gupParams.isSilentMode())
+			::MessageBoxA(NULL, errMsg.c_str(), "curl error", MB_OK);
+	};
+
+private:
+	const GupParameters & _gupParams;
+	GupNativeLang & _nativeLang;
+	bool _isDialogStarted = false;
+};
+
+// Tells the user what came out of the update of a program, returns the exit code
+static int reportResult(GupEngineResult result, const GupEngine & engine, const GupParameters & gupParams, GupNativeLang & nativeLang)
+{
+	bool isSilentMode = gupParams.isSilentMode();
+	switch (result)
+	{
+		case gupNoUpdate:
+		{
+			if (!isSilentMode)
+			{
+				string noUpdate = nativeLang.getMessageString("MSGID_NOUPDATE");
+				if (noUpdate == "")
+					noUpdate = MSGID_NOUPDATE;
+				::MessageBoxA(NULL, noUpdate.c_str(), gupParams.getMessageBoxTitle().c_str(), MB_OK);
+			}
+			return 0;
 		}
 
-		curl_easy_setopt(curl, CURLOPT_USERAGENT, winGupUserAgent.c_str());
-		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer);
+		case gupDownloadAborted:
+		{
+			string dlStopped = nativeLang.getMessageString("MSGID_DOWNLOADSTOPPED");
+			if (dlStopped == "")
+				dlStopped = MSGID_DOWNLOADSTOPPED;
+			::MessageBoxA(NULL, dlStopped.c_str(), gupParams.getMessageBoxTitle().c_str(), MB_OK);
+			return -1;
+		}
 
-		if (proxyServer.hasProxySettings())
+		case gupPackageCorrupted:
 		{
-			curl_easy_setopt(curl, CURLOPT_PROXY, proxyServer.getProxyServer().c_str());
-			curl_easy_setopt(curl, CURLOPT_PROXYPORT, proxyServer.getPort());
+			if (!isSilentMode)
+			{
+				string corrupted = nativeLang.getMessageString("MSGID_PACKAGECORRUPTED");
+				if (corrupted == "")
+					corrupted = MSGID_PACKAGECORRUPTED;
+				::MessageBoxA(NULL, corrupted.c_str(), gupParams.getMessageBoxTitle().c_str(), MB_OK);
+			}
+			return -1;
 		}
 
-		curl_easy_setopt(curl, CURLOPT_SSL_OPTIONS, CURLSSLOPT_ALLOW_BEAST | CURLSSLOPT_NO_REVOKE);
+		case gupSignatureInvalid:
+		{
+			if (!isSilentMode)
+			{
+				string signatureInvalid = nativeLang.getMessageString("MSGID_SIGNATUREINVALID");
+				if (signatureInvalid == "")
+					signatureInvalid = MSGID_SIGNATUREINVALID;
+				::MessageBoxA(NULL, signatureInvalid.c_str(), gupParams.getMessageBoxTitle().c_str(), MB_OK);
+			}
+			return -1;
+		}
 
-		res = curl_easy_perform(curl);
+		case gupNetworkError:
+			return -1;
 
-		curl_easy_cleanup(curl);
-	}
+		case gupCheckUnknown:
+		case gupCheckDeferred:
+		{
+			// Quiet when launched in the background, but the user who asked should know
+			if (!isSilentMode)
+				::MessageBoxA(NULL, engine.getLastError().c_str(), gupParams.getMessageBoxTitle().c_str(), MB_OK);
+			return -1;
+		}
 
-	if (res != CURLE_OK)
-	{
-		if (!gupParams.isSilentMode())
-			::MessageBoxA(NULL, errorBuffer, "curl error", MB_OK);
-		return false;
+		default:
+			return 0;
 	}
-	return true;
 }
 
-bool runInstaller(const string& app2runPath, const string& binWindowsClassName, const string& closeMsg, const string& closeMsgTitle)
+// The performance options of the command line, over the ones of gupOptions.xml
+static void applyCommandLine(GupEngine & engine, const GupCommandLine & cmdLine, const GupExtraOptions & extraOptions)
 {
+	// The user who asked for a check doesn't wait for the time the server asked for
+	engine.setScheduleEnabled(!cmdLine.isVerbose);
+
+	if (cmdLine.checkTimeout >= 0 || cmdLine.connectTimeout >= 0)
+		engine.setCheckTimeout(cmdLine.checkTimeout >= 0 ? cmdLine.checkTimeout : extraOptions.getCheckTimeout(),
+			cmdLine.connectTimeout >= 0 ? cmdLine.connectTimeout : extraOptions.getCheckConnectTimeout());
+	if (cmdLine.segmentCount > 0)
+		engine.setSegmentCount(cmdLine.segmentCount);
+	if (!cmdLine.cacheDir.empty())
+		engine.setCacheDir(cmdLine.cacheDir);
+	if (!cmdLine.logPath.empty())
+		engine.setLogPath(cmdLine.logPath);
+}
 
-	if (!binWindowsClassName.empty())
+// -c: the update checks of all the programs at once, then each one goes on like a single one
+static int runBatch(const GupCommandLine & cmdLine, const GupExtraOptions & extraOptions, GupNativeLang & nativeLang)
+{
+	const string & configList = cmdLine.configList;
+	bool isVerbose = cmdLine.isVerbose;
+	vector<unique_ptr<GupParameters>> products;
+	vector<unique_ptr<GupEngine>> engines;
+	vector<GupEngine *> batch;
+	int exitCode = 0;
+
+	string::size_type start = 0;
+	while (start < configList.size())
 	{
-		HWND h = ::FindWindowExA(NULL, NULL, binWindowsClassName.c_str(), NULL);
-
-		if (h)
-		{
-			int installAnswer = ::MessageBoxA(NULL, closeMsg.c_str(), closeMsgTitle.c_str(), MB_YESNO);
-
-			if (installAnswer == IDNO)
-			{
-				return 0;
-			}
+		string::size_type end = configList.find(';', start);
+		if (end == string::npos)
+			end = configList.size();
+		string configPath = configList.substr(start, end - start);
+		start = end + 1;
+		if (configPath.empty())
+			continue;
+
+		try {
+			products.emplace_back(new GupParameters(configPath.c_str()));
 		}
-
-		// kill all process of binary needs to be updated.
-		while (h)
+		catch (const exception & ex)
 		{
-			::SendMessage(h, WM_CLOSE, 0, 0);
-			h = ::FindWindowExA(NULL, NULL, binWindowsClassName.c_str(), NULL);
+			if (isVerbose)
+				::MessageBoxA(NULL, (configPath + ": " + ex.what()).c_str(), "Xml Exception", MB_OK);
+			exitCode = -1;
+			continue;
 		}
+
+		if (isVerbose)
+			products.back()->setSilentMode(false);
+		engines.emplace_back(new GupEngine(*products.back(), extraOptions));
+		applyCommandLine(*engines.back(), cmdLine, extraOptions);
+		batch.push_back(engines.back().get());
 	}
 
-	// execute the installer
-	HINSTANCE result = ::ShellExecuteA(NULL, "open", app2runPath.c_str(), "", ".", SW_SHOW);
+	GupEngine::checkUpdates(batch);
 
-	if (result <= (HINSTANCE)32) // There's a problem (Don't ask me why, ask Microsoft)
+	for (size_t i = 0; i < engines.size(); ++i)
 	{
-		return false;
-	}
+		const GupParameters & gupParams = *products[i];
+		msgBoxTitle = gupParams.getMessageBoxTitle();
+		appIconFile = gupParams.getSoftwareIcon();
+		WinGupCallbacks callbacks(gupParams, nativeLang);
 
-	return true;
+		// The abort of the download of a previous program doesn't stop this one
+		doAbort = false;
+		stopDL = false;
+		isProgressDlgDone = false;
+
+		// An update info which can't be parsed only stops its program
+		try {
+			if (reportResult(engines[i]->run(callbacks), *engines[i], gupParams, nativeLang) != 0)
+				exitCode = -1;
+		}
+		catch (const exception & ex)
+		{
+			if (!gupParams.isSilentMode())
+				::MessageBoxA(NULL, ex.what(), "Xml Exception", MB_OK);
+			exitCode = -1;
+		}
+	}
+	return exitCode;
 }
 
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpszCmdLine, int)
@@ -591,37 +593,34 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpszCmdLine, int)
 	bool isSilentMode = false;
 	FILE *pFile = NULL;
 
-	bool launchSettingsDlg = false;
-	bool isVerbose = false;
-	bool isHelp = false;
-	string version = "";
-	string customParam = "";
+	GupCommandLine cmdLine(lpszCmdLine);
 
-	if (lpszCmdLine && lpszCmdLine[0])
+	// Several programs, each one with its own gup.xml
+	if (!cmdLine.configList.empty() && !cmdLine.isHelp && !cmdLine.isOptionsDlg)
 	{
-		launchSettingsDlg = isInList(FLAG_OPTIONS, lpszCmdLine);
-		isVerbose = isInList(FLAG_VERBOSE, lpszCmdLine);
-		isHelp = isInList(FLAG_HELP, lpszCmdLine);
-		version = getParamVal('v', lpszCmdLine);
-		customParam = getParamVal('p', lpszCmdLine);
+		hInst = hInstance;
+		GupExtraOptions extraOptions("gupOptions.xml");
+		GupNativeLang nativeLang("nativeLang.xml");
+		return runBatch(cmdLine, extraOptions, nativeLang);
 	}
 
-	// Object (gupParams) is moved here because we need app icon form configuration file
-	GupParameters gupParams("gup.xml");
-	appIconFile = gupParams.getSoftwareIcon();
-
-	if (isHelp)
+	// Nothing to read for the help
+	if (cmdLine.isHelp)
 	{
 		::MessageBoxA(NULL, MSGID_HELP, "GUP Command Argument Help", MB_OK);
 		return 0;
 	}
 
+	// Object (gupParams) is moved here because we need app icon form configuration file
+	GupParameters gupParams("gup.xml");
+	appIconFile = gupParams.getSoftwareIcon();
+
 	GupExtraOptions extraOptions("gupOptions.xml");
 	GupNativeLang nativeLang("nativeLang.xml");
 
 	hInst = hInstance;
 	try {
-		if (launchSettingsDlg)
+		if (cmdLine.isOptionsDlg)
 		{
 			if (extraOptions.hasProxySettings())
 			{
@@ -635,122 +634,27 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR lpszCmdLine, int)
 		}
 
 		msgBoxTitle = gupParams.getMessageBoxTitle();
-		abortOrNot = nativeLang.getMessageString("MSGID_ABORTORNOT");
-
-		//
-		// Get update info
-		//
-		std::string updateInfo;
 
 		// Get your software's current version.
 		// If you pass the version number as the argument
 		// then the version set in the gup.xml will be overrided
-		if (!version.empty())
-			gupParams.setCurrentVersion(version.c_str());
+		if (!cmdLine.version.empty())
+			gupParams.setCurrentVersion(cmdLine.version.c_str());
+
+		if (!cmdLine.customParam.empty())
+			gupParams.setParam(cmdLine.customParam.c_str());
 
 		// override silent mode if "-isVerbose" is passed as argument
-		if (isVerbose)
+		if (cmdLine.isVerbose)
 			gupParams.setSilentMode(false);
 
 		isSilentMode = gupParams.isSilentMode();
 
-		bool getUpdateInfoSuccessful = getUpdateInfo(updateInfo, gupParams, extraOptions, customParam, version);
-
-		if (!getUpdateInfoSuccessful)
-			return -1;
-		
-
-		GupDownloadInfo gupDlInfo(updateInfo.c_str());
-
-		if (!gupDlInfo.doesNeed2BeUpdated())
-		{
-			if (!isSilentMode)
-			{
-				string noUpdate = nativeLang.getMessageString("MSGID_NOUPDATE");
-				if (noUpdate == "")
-					noUpdate = MSGID_NOUPDATE;
-				::MessageBoxA(NULL, noUpdate.c_str(), gupParams.getMessageBoxTitle().c_str(), MB_OK);
-			}
-			return 0;
-		}
-
-
-		//
-		// Process Update Info
-		//
-
-		// Ask user if he/she want to do update
-		string updateAvailable = nativeLang.getMessageString("MSGID_UPDATEAVAILABLE");
-		if (updateAvailable == "")
-			updateAvailable = MSGID_UPDATEAVAILABLE;
-		
-		int thirdButtonCmd = gupParams.get3rdButtonCmd();
-		thirdDoUpdateDlgButtonLabel = gupParams.get3rdButtonLabel();
-
-		int dlAnswer = 0;
-		HWND hApp = ::FindWindowExA(NULL, NULL, gupParams.getClassName().c_str(), NULL);
-		bool isModal = gupParams.isMessageBoxModal();
-
-		if (!thirdButtonCmd)
-			dlAnswer = ::MessageBoxA(isModal ? hApp : NULL, updateAvailable.c_str(), gupParams.getMessageBoxTitle().c_str(), MB_YESNO);
-		else
-			dlAnswer = static_cast<int32_t>(::DialogBox(hInst, MAKEINTRESOURCE(IDD_YESNONEVERDLG), isModal ? hApp : NULL, reinterpret_cast<DLGPROC>(yesNoNeverDlgProc)));
-
-		if (dlAnswer == IDNO)
-		{
-			return 0;
-		}
-		
-		if (dlAnswer == IDCANCEL)
-		{
-			if (gupParams.getClassName() != "")
-			{
-				if (hApp)
-				{
-					::SendMessage(hApp, thirdButtonCmd, gupParams.get3rdButtonWparam(), gupParams.get3rdButtonLparam());
-				}
-			}
-			return 0;
-		}
-
-		//
-		// Download executable bin
-		//
-		::CreateThread(NULL, 0, launchProgressBar, NULL, 0, NULL);
-		
-		std::string dlDest = std::getenv("TEMP");
-		dlDest += "\\";
-		dlDest += ::PathFindFileNameA(gupDlInfo.getDownloadLocation().c_str());
-
-        char *ext = ::PathFindExtensionA(gupDlInfo.getDownloadLocation().c_str());
-        if (strcmp(ext, ".exe") != 0)
-            dlDest += ".exe";
-
-		dlFileName = ::PathFindFileNameA(gupDlInfo.getDownloadLocation().c_str());
+		GupEngine engine(gupParams, extraOptions);
+		applyCommandLine(engine, cmdLine, extraOptions);
+		WinGupCallbacks callbacks(gupParams, nativeLang);
 
-
-		string dlStopped = nativeLang.getMessageString("MSGID_DOWNLOADSTOPPED");
-		if (dlStopped == "")
-			dlStopped = MSGID_DOWNLOADSTOPPED;
-
-		bool dlSuccessful = downloadBinary(gupDlInfo.getDownloadLocation(), dlDest, pair<string, int>(extraOptions.getProxyServer(), extraOptions.getPort()), isSilentMode, pair<string, string>(dlStopped, gupParams.getMessageBoxTitle()));
-
-		if (!dlSuccessful)
-			return -1;
-
-
-		//
-		// Run executable bin
-		//
-		string msg = gupParams.getClassName();
-		string closeApp = nativeLang.getMessageString("MSGID_CLOSEAPP");
-		if (closeApp == "")
-			closeApp = MSGID_CLOSEAPP;
-		msg += closeApp;
-
-		runInstaller(dlDest, gupParams.getClassName(), msg, gupParams.getMessageBoxTitle().c_str());
-
-		return 0;
+		return reportResult(engine.run(callbacks), engine, gupParams, nativeLang);
 
 	} catch (exception ex) {
 		if (!isSilentMode)
@@ -17,17 +17,87 @@
  along with GUP.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <random>
+#include "gupVersion.h"
 #include "xmlTools.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <strings.h>
+#include <sys/stat.h>
+#define stricmp strcasecmp
+#endif
+
 using namespace std;
 
+static std::string getChildText(TiXmlNode *parent, const char *name)
+{
+	TiXmlNode *node = parent->FirstChildElement(name);
+	if (!node)
+		return "";
+
+	TiXmlNode *n = node->FirstChild();
+	if (!n)
+		return "";
+
+	const char *val = n->Value();
+	return val ? val : "";
+}
+
+static void addChildText(TiXmlNode *parent, const char *name, const std::string & text)
+{
+	TiXmlNode *node = parent->InsertEndChild(TiXmlElement(name));
+	node->InsertEndChild(TiXmlText(text.c_str()));
+}
+
+// <Hash algo="sha256">: false if the algo isn't supported or the value is incorrect
+static bool readSha256(TiXmlElement *hashNode, std::string & sha256)
+{
+	const char *algo = hashNode->Attribute("algo");
+	if (!algo || stricmp(algo, "sha256") != 0)
+		return false;
+
+	TiXmlNode *hn = hashNode->FirstChild();
+	const char *hashVal = hn ? hn->Value() : NULL;
+	if (!hashVal || strlen(hashVal) != 64 || strspn(hashVal, "0123456789abcdefABCDEF") != 64)
+		return false;
+
+	sha256 = hashVal;
+	transform(sha256.begin(), sha256.end(), sha256.begin(), ::tolower);
+	return true;
+}
+
+static bool isHexString(const std::string & value, size_t digits)
+{
+	return value.size() == digits && strspn(value.c_str(), "0123456789abcdefABCDEF") == digits;
+}
+
 GupParameters::GupParameters(const char * xmlFileName)
 {
-	_xmlDoc.LoadFile(xmlFileName);
+	GupFileStamp stamp;
+	if (loadSnapshot(xmlFileName, stamp))
+		return;
+
+	parseXml(xmlFileName);
+	saveSnapshot(xmlFileName, stamp);
+}
 
-	TiXmlNode *root = _xmlDoc.FirstChild("GUPInput");
+void GupParameters::parseXml(const char * xmlFileName)
+{
+	TiXmlDocument xmlDoc;
+	xmlDoc.LoadFile(xmlFileName);
+
+	TiXmlNode *root = xmlDoc.FirstChild("GUPInput");
 	if (!root)
-		throw exception("It's not a valid GUP input xml.");
+		throw runtime_error("It's not a valid GUP input xml.");
 
 	TiXmlNode *versionNode = root->FirstChildElement("Version");
 	if (versionNode)
@@ -59,18 +129,34 @@ GupParameters::GupParameters(const char * xmlFileName)
 	
 	TiXmlNode *infoURLNode = root->FirstChildElement("InfoUrl");
 	if (!infoURLNode)
-		throw exception("InfoUrl node is missed.");
+		throw runtime_error("InfoUrl node is missed.");
 
 	TiXmlNode *iu = infoURLNode->FirstChild();
 	if (!iu)
-		throw exception("InfoUrl is missed.");
+		throw runtime_error("InfoUrl is missed.");
 		
 	const char *iuVal = iu->Value();
 	if (!iuVal || !(*iuVal))
-		throw exception("InfoUrl is missed.");
+		throw runtime_error("InfoUrl is missed.");
 	
 	_infoUrl = iuVal;
 
+	// A static manifest is the same for every client: no version nor param in its url, so a CDN can cache it
+	const char *isStatic = infoURLNode->ToElement()->Attribute("static");
+	_isInfoStatic = isStatic && stricmp(isStatic, "yes") == 0;
+
+	// Several keys: the next one of a key rotation is pinned before the server signs with it
+	for (TiXmlElement *keyNode = root->FirstChildElement("PublicKey"); keyNode; keyNode = keyNode->NextSiblingElement("PublicKey"))
+	{
+		TiXmlNode *kn = keyNode->FirstChild();
+		string key = kn && kn->Value() ? kn->Value() : "";
+		if (!isHexString(key, 64))
+			throw runtime_error("PublicKey is incorrect (an Ed25519 public key is 64 hexadecimal digits).");
+		_publicKeys.push_back(key);
+	}
+
+	_channel = getChildText(root, "Channel");
+
 	TiXmlNode *classeNameNode = root->FirstChildElement("ClassName2Close");
 	if (classeNameNode)
 	{
@@ -108,7 +194,7 @@ GupParameters::GupParameters(const char * xmlFileName)
 			else if (stricmp(valStr, "no") == 0)
 				_isMessageBoxModal = false;
 			else
-				throw exception("isModal value is incorrect (only \"yes\" or \"no\" is allowed).");
+				throw runtime_error("isModal value is incorrect (only \"yes\" or \"no\" is allowed).");
 		}
 
         int val = 0;
@@ -151,7 +237,7 @@ GupParameters::GupParameters(const char * xmlFileName)
 				else if (stricmp(smnVal, "no") == 0)
 					_isSilentMode = false;
 				else
-					throw exception("SilentMode value is incorrect (only \"yes\" or \"no\" is allowed).");
+					throw runtime_error("SilentMode value is incorrect (only \"yes\" or \"no\" is allowed).");
 			}
 		}
 	}
@@ -187,71 +273,530 @@ GupParameters::GupParameters(const char * xmlFileName)
 
 GupDownloadInfo::GupDownloadInfo(const char * xmlString) : _updateVersion(""), _updateLocation("")
 {
-	_xmlDoc.Parse(xmlString);
+	parseXml(xmlString, "");
+}
 
-	TiXmlNode *root = _xmlDoc.FirstChild("GUP");
+GupDownloadInfo::GupDownloadInfo(const std::string & answer, const std::string & channel) : _updateVersion(""), _updateLocation("")
+{
+	if (isManifest(answer))
+		parseManifest(answer, channel);
+	else
+		parseXml(answer.c_str(), channel);
+}
+
+void GupDownloadInfo::parseXml(const char * xmlString, const std::string & channel)
+{
+	TiXmlDocument xmlDoc;
+	xmlDoc.Parse(xmlString);
+
+	TiXmlNode *root = xmlDoc.FirstChild("GUP");
 	if (!root)
-		throw exception("It's not a valid GUP xml.");
+		throw runtime_error("It's not a valid GUP xml.");
 
 	TiXmlNode *needUpdateNode = root->FirstChildElement("NeedToBeUpdated");
-	if (!needUpdateNode)
-		throw exception("NeedToBeUpdated node is missed.");
+	if (needUpdateNode)
+	{
+		TiXmlNode *nun = needUpdateNode->FirstChild();
+		if (!nun)
+			throw runtime_error("NeedToBeUpdated is missed.");
 
-	TiXmlNode *nun = needUpdateNode->FirstChild();
-	if (!nun)
-		throw exception("NeedToBeUpdated is missed.");
-		
-	const char *nunVal = nun->Value();
-	if (!nunVal || !(*nunVal))
-		throw exception("NeedToBeUpdated is missed.");
-	
-	if (stricmp(nunVal, "yes") == 0)
-		_need2BeUpdated = true;
-	else if (stricmp(nunVal, "no") == 0)
-		_need2BeUpdated = false;
+		const char *nunVal = nun->Value();
+		if (!nunVal || !(*nunVal))
+			throw runtime_error("NeedToBeUpdated is missed.");
+
+		if (stricmp(nunVal, "yes") == 0)
+			_need2BeUpdated = true;
+		else if (stricmp(nunVal, "no") == 0)
+			_need2BeUpdated = false;
+		else
+			throw runtime_error("NeedToBeUpdated value is incorrect (only \"yes\" or \"no\" is allowed).");
+	}
 	else
-		throw exception("NeedToBeUpdated value is incorrect (only \"yes\" or \"no\" is allowed).");
+	{
+		// A static manifest, the same file for all the clients: it names the latest version, each client compares it to its own
+		if (getChildText(root, "Version").empty())
+			throw runtime_error("NeedToBeUpdated node is missed.");
+		_isStatic = true;
+		_need2BeUpdated = true;
+	}
+
+	// Hints of a loaded server, whatever the answer
+	_retryAfter = max(strtol(getChildText(root, "RetryAfter").c_str(), NULL, 10), 0L);
+	_minCheckInterval = max(strtol(getChildText(root, "MinCheckInterval").c_str(), NULL, 10), 0L);
+	string rollout = getChildText(root, "Rollout");
+	if (!rollout.empty())
+		_rollout = min(max(atoi(rollout.c_str()), 0), 100);
 
 	if (_need2BeUpdated)
+		parseRelease(root);
+
+	// The clients of a channel take its release if it's newer than the main one: the beta testers get the next
+	// stable release too. A channel without its own Rollout is offered to all its clients
+	if (_isStatic && !channel.empty())
 	{
-		//
-		// Get mandatory parameters
-		//
-		TiXmlNode *versionNode = root->FirstChildElement("Version");
-		if (versionNode)
+		for (TiXmlElement *channelNode = root->FirstChildElement("Channel"); channelNode; channelNode = channelNode->NextSiblingElement("Channel"))
 		{
-			TiXmlNode *n = versionNode->FirstChild();
-			if (n)
+			const char *name = channelNode->Attribute("name");
+			if (!name || channel != name)
+				continue;
+
+			GupDownloadInfo release;
+			release.parseRelease(channelNode);
+			string channelRollout = getChildText(channelNode, "Rollout");
+			if (!channelRollout.empty())
+				release._rollout = min(max(atoi(channelRollout.c_str()), 0), 100);
+			takeNewerRelease(release, channel);
+		}
+	}
+}
+
+void GupDownloadInfo::parseRelease(TiXmlNode *node)
+{
+	//
+	// Get mandatory parameters
+	//
+	TiXmlNode *versionNode = node->FirstChildElement("Version");
+	if (versionNode)
+	{
+		TiXmlNode *n = versionNode->FirstChild();
+		if (n)
+		{
+			const char *val = n->Value();
+			if (val)
 			{
-				const char *val = n->Value();
-				if (val)
-				{
-					_updateVersion = val;
-				}
+				_updateVersion = val;
 			}
 		}
-		
-		TiXmlNode *locationNode = root->FirstChildElement("Location");
-		if (!locationNode)
-			throw exception("Location node is missed.");
+	}
+	
+	TiXmlElement *locationNode = node->FirstChildElement("Location");
+	if (!locationNode)
+		throw runtime_error("Location node is missed.");
 
+	// Several Location are mirrors of the same package
+	for (; locationNode; locationNode = locationNode->NextSiblingElement("Location"))
+	{
 		TiXmlNode *ln = locationNode->FirstChild();
 		if (!ln)
-			throw exception("Location is missed.");
-			
+			throw runtime_error("Location is missed.");
+
 		const char *locVal = ln->Value();
 		if (!locVal || !(*locVal))
-			throw exception("Location is missed.");
-		
-		_updateLocation = locVal;
+			throw runtime_error("Location is missed.");
+
+		GupMirror mirror;
+		mirror.location = locVal;
+		int weight = 1;
+		if (locationNode->QueryIntAttribute("weight", &weight) == TIXML_SUCCESS && weight >= 0)
+			mirror.weight = weight;
+		_mirrors.push_back(mirror);
+	}
+
+	_updateLocation = _mirrors.front().location;
+
+	//
+	// Get optional parameters
+	//
+	TiXmlElement *hashNode = node->FirstChildElement("Hash");
+	// Better no update than running a package we can't verify
+	if (hashNode && !readSha256(hashNode, _sha256))
+		throw runtime_error("Hash is incorrect (only algo=\"sha256\" with 64 hexadecimal digits is supported).");
+
+	_signature = getChildText(node, "Signature");
+	if (!_signature.empty() && !isHexString(_signature, 128))
+		throw runtime_error("Signature is incorrect (an Ed25519 signature is 128 hexadecimal digits).");
+
+	// The full package is the fallback of the deltas: an incomplete one is ignored
+	for (TiXmlElement *deltaNode = node->FirstChildElement("Delta"); deltaNode; deltaNode = deltaNode->NextSiblingElement("Delta"))
+	{
+		GupDelta delta;
+		const char *from = deltaNode->Attribute("from");
+		delta.from = from ? from : "";
+		delta.location = getChildText(deltaNode, "Location");
+		delta.base = getChildText(deltaNode, "Base");
+
+		TiXmlElement *deltaHashNode = deltaNode->FirstChildElement("Hash");
+		if (deltaHashNode && !readSha256(deltaHashNode, delta.sha256))
+			continue;
+
+		if (!delta.from.empty() && !delta.location.empty() && !delta.base.empty())
+			_deltas.push_back(delta);
+	}
+}
+
+void GupDownloadInfo::takeNewerRelease(GupDownloadInfo & release, const std::string & channel)
+{
+	if (!(GupVersion(release._updateVersion) > GupVersion(_updateVersion)))
+		return;
+
+	_updateVersion = release._updateVersion;
+	_updateLocation = release._updateLocation;
+	_mirrors.swap(release._mirrors);
+	_sha256 = release._sha256;
+	_signature = release._signature;
+	_deltas.swap(release._deltas);
+	_rollout = release._rollout;
+	_channel = channel;
+}
+
+const char MANIFEST_MAGIC[] = "GUPM";
+const size_t MANIFEST_MAGIC_SIZE = 4;
+const unsigned char MANIFEST_SCHEMA = 1;
+const size_t SHA256_SIZE = 32;
+const size_t SIGNATURE_SIZE = 64;
+
+enum ManifestTag
+{
+	manifestNeedToBeUpdated = 1,
+	manifestVersion,
+	manifestLocation,
+	manifestWeight,
+	manifestHash,
+	manifestDelta,
+	manifestRetryAfter,
+	manifestMinCheckInterval,
+	manifestRollout,
+	manifestSignature,
+	manifestChannel,
+	manifestChannelName
+};
+
+enum ManifestDeltaTag
+{
+	deltaFrom = 1,
+	deltaLocation,
+	deltaBase,
+	deltaHash
+};
+
+// Records of a binary manifest, one after the other
+class ManifestReader
+{
+public:
+	ManifestReader(const std::string & data, size_t pos) : _data(data), _pos(pos) {};
+
+	// False at the end, throws if the record is truncated
+	bool next(int & tag, std::string & value)
+	{
+		if (_pos >= _data.size())
+			return false;
+
+		tag = static_cast<unsigned char>(_data[_pos++]);
+		uint64_t size = readVarint(_data, _pos);
+		if (size > _data.size() - _pos)
+			throw runtime_error("The binary manifest is truncated.");
+
+		value.assign(_data, _pos, static_cast<size_t>(size));
+		_pos += static_cast<size_t>(size);
+		return true;
+	};
+
+	static uint64_t readVarint(const std::string & data, size_t & pos)
+	{
+		uint64_t value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (pos >= data.size())
+				throw runtime_error("The binary manifest is truncated.");
+
+			unsigned char byte = static_cast<unsigned char>(data[pos++]);
+			value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		throw runtime_error("The binary manifest has an invalid number.");
+	};
+
+	static uint64_t toNumber(const std::string & value)
+	{
+		size_t pos = 0;
+		return readVarint(value, pos);
+	};
+
+private:
+	const std::string & _data;
+	size_t _pos;
+};
+
+static std::string toHex(const std::string & bytes)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string hex;
+	for (char c : bytes)
+	{
+		hex += digits[static_cast<unsigned char>(c) >> 4];
+		hex += digits[static_cast<unsigned char>(c) & 0x0F];
 	}
+	return hex;
+}
+
+static std::string fromHex(const std::string & hex)
+{
+	std::string bytes;
+	for (size_t i = 0; i + 1 < hex.size(); i += 2)
+		bytes += static_cast<char>(strtol(hex.substr(i, 2).c_str(), NULL, 16));
+	return bytes;
+}
+
+static void writeVarint(std::string & out, uint64_t value)
+{
+	do
+	{
+		unsigned char byte = value & 0x7F;
+		value >>= 7;
+		out += static_cast<char>(value ? byte | 0x80 : byte);
+	} while (value);
+}
+
+static void writeRecord(std::string & out, int tag, const std::string & value)
+{
+	out += static_cast<char>(tag);
+	writeVarint(out, value.size());
+	out += value;
+}
+
+static void writeNumber(std::string & out, int tag, uint64_t value)
+{
+	std::string number;
+	writeVarint(number, value);
+	writeRecord(out, tag, number);
+}
+
+// Zigzag: the small negative numbers stay short
+static void writeSignedNumber(std::string & out, int tag, int64_t value)
+{
+	writeNumber(out, tag, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+static int64_t toSignedNumber(const std::string & value)
+{
+	uint64_t number = ManifestReader::toNumber(value);
+	return static_cast<int64_t>(number >> 1) ^ -static_cast<int64_t>(number & 1);
+}
+
+bool GupDownloadInfo::isManifest(const std::string & answer)
+{
+	return answer.compare(0, MANIFEST_MAGIC_SIZE, MANIFEST_MAGIC) == 0;
+}
+
+void GupDownloadInfo::parseManifest(const std::string & manifest, const std::string & channel)
+{
+	if (manifest.size() <= MANIFEST_MAGIC_SIZE || static_cast<unsigned char>(manifest[MANIFEST_MAGIC_SIZE]) > MANIFEST_SCHEMA)
+		throw runtime_error("The binary manifest is of an unsupported version.");
+
+	bool hasNeedToBeUpdated = false;
+	vector<string> channels;
+	parseManifestRecords(manifest, MANIFEST_MAGIC_SIZE + 1, hasNeedToBeUpdated, channels);
+
+	if (!hasNeedToBeUpdated)
+	{
+		// Static manifest, like in the XML
+		if (_updateVersion.empty())
+			throw runtime_error("NeedToBeUpdated is missed.");
+		_isStatic = true;
+		_need2BeUpdated = true;
+	}
+
+	if (_need2BeUpdated)
+	{
+		if (_mirrors.empty())
+			throw runtime_error("Location is missed.");
+		_updateLocation = _mirrors.front().location;
+	}
+	else
+	{
+		// Like in the XML, the rest only matters with an update
+		_updateVersion.clear();
+		_mirrors.clear();
+		_sha256.clear();
+		_signature.clear();
+		_deltas.clear();
+	}
+
+	// Channels, like in the XML
+	for (size_t i = 0; i < channels.size() && _isStatic && !channel.empty(); ++i)
+	{
+		GupDownloadInfo release;
+		vector<string> nestedChannels;
+		release.parseManifestRecords(channels[i], 0, hasNeedToBeUpdated, nestedChannels);
+		if (release._channel != channel)
+			continue;
+
+		if (release._mirrors.empty())
+			throw runtime_error("Location is missed.");
+		release._updateLocation = release._mirrors.front().location;
+		takeNewerRelease(release, channel);
+	}
+}
+
+void GupDownloadInfo::parseManifestRecords(const std::string & records, size_t pos, bool & hasNeedToBeUpdated, std::vector<std::string> & channels)
+{
+	ManifestReader reader(records, pos);
+	int tag = 0;
+	string value;
+	while (reader.next(tag, value))
+	{
+		switch (tag)
+		{
+			case manifestNeedToBeUpdated:
+				_need2BeUpdated = ManifestReader::toNumber(value) != 0;
+				hasNeedToBeUpdated = true;
+				break;
+
+			case manifestChannel:
+				channels.push_back(value);
+				break;
+
+			case manifestChannelName:
+				_channel = value;
+				break;
+
+			case manifestVersion:
+				_updateVersion = value;
+				break;
+
+			case manifestLocation:
+			{
+				GupMirror mirror;
+				mirror.location = value;
+				_mirrors.push_back(mirror);
+				break;
+			}
+
+			case manifestWeight:
+				if (!_mirrors.empty())
+					_mirrors.back().weight = static_cast<int>(min<uint64_t>(ManifestReader::toNumber(value), INT32_MAX));
+				break;
+
+			case manifestHash:
+				if (value.size() != SHA256_SIZE)
+					throw runtime_error("Hash is incorrect (only SHA-256 is supported).");
+				_sha256 = toHex(value);
+				break;
+
+			case manifestSignature:
+				if (value.size() != SIGNATURE_SIZE)
+					throw runtime_error("Signature is incorrect (an Ed25519 signature is 64 bytes).");
+				_signature = toHex(value);
+				break;
+
+			case manifestDelta:
+			{
+				GupDelta delta;
+				ManifestReader deltaReader(value, 0);
+				int deltaTag = 0;
+				string deltaValue;
+				bool isValid = true;
+				while (deltaReader.next(deltaTag, deltaValue))
+				{
+					if (deltaTag == deltaFrom)
+						delta.from = deltaValue;
+					else if (deltaTag == deltaLocation)
+						delta.location = deltaValue;
+					else if (deltaTag == deltaBase)
+						delta.base = deltaValue;
+					else if (deltaTag == deltaHash)
+					{
+						isValid = deltaValue.size() == SHA256_SIZE;
+						delta.sha256 = toHex(deltaValue);
+					}
+				}
+
+				// Like in the XML: an incomplete delta is ignored, the full package is its fallback
+				if (isValid && !delta.from.empty() && !delta.location.empty() && !delta.base.empty())
+					_deltas.push_back(delta);
+				break;
+			}
+
+			case manifestRetryAfter:
+				_retryAfter = static_cast<long>(min<uint64_t>(ManifestReader::toNumber(value), INT32_MAX));
+				break;
+
+			case manifestMinCheckInterval:
+				_minCheckInterval = static_cast<long>(min<uint64_t>(ManifestReader::toNumber(value), INT32_MAX));
+				break;
+
+			case manifestRollout:
+				_rollout = static_cast<int>(min<uint64_t>(ManifestReader::toNumber(value), 100));
+				break;
+		}
+	}
+}
+
+std::string GupDownloadInfo::toManifest() const
+{
+	string manifest(MANIFEST_MAGIC, MANIFEST_MAGIC_SIZE);
+	manifest += static_cast<char>(MANIFEST_SCHEMA);
+
+	if (!_isStatic)
+		writeNumber(manifest, manifestNeedToBeUpdated, _need2BeUpdated ? 1 : 0);
+	if (_need2BeUpdated)
+	{
+		writeRecord(manifest, manifestVersion, _updateVersion);
+		for (const GupMirror & mirror : _mirrors)
+		{
+			writeRecord(manifest, manifestLocation, mirror.location);
+			if (mirror.weight != 1)
+				writeNumber(manifest, manifestWeight, mirror.weight);
+		}
+		if (!_sha256.empty())
+			writeRecord(manifest, manifestHash, fromHex(_sha256));
+		if (!_signature.empty())
+			writeRecord(manifest, manifestSignature, fromHex(_signature));
+
+		for (const GupDelta & delta : _deltas)
+		{
+			string deltaRecords;
+			writeRecord(deltaRecords, deltaFrom, delta.from);
+			writeRecord(deltaRecords, deltaLocation, delta.location);
+			writeRecord(deltaRecords, deltaBase, delta.base);
+			if (!delta.sha256.empty())
+				writeRecord(deltaRecords, deltaHash, fromHex(delta.sha256));
+			writeRecord(manifest, manifestDelta, deltaRecords);
+		}
+	}
+
+	if (_retryAfter > 0)
+		writeNumber(manifest, manifestRetryAfter, _retryAfter);
+	if (_minCheckInterval > 0)
+		writeNumber(manifest, manifestMinCheckInterval, _minCheckInterval);
+	if (_rollout < 100)
+		writeNumber(manifest, manifestRollout, _rollout);
+	return manifest;
+}
+
+void GupDownloadInfo::compareVersion(const std::string & currentVersion)
+{
+	if (_isStatic)
+		_need2BeUpdated = GupVersion(_updateVersion) > GupVersion(currentVersion);
+}
+
+const GupDelta * GupDownloadInfo::findDelta(const std::string & fromVersion) const
+{
+	for (const GupDelta & delta : _deltas)
+	{
+		if (delta.from == fromVersion)
+			return &delta;
+	}
+	return NULL;
 }
 
 GupExtraOptions::GupExtraOptions(const char * xmlFileName) : _proxyServer(""), _port(-1)//, _hasProxySettings(false)
 {
-	_xmlDoc.LoadFile(xmlFileName);
+	GupFileStamp stamp;
+	if (loadSnapshot(xmlFileName, stamp))
+		return;
+
+	parseXml(xmlFileName);
+	saveSnapshot(xmlFileName, stamp);
+}
+
+void GupExtraOptions::parseXml(const char * xmlFileName)
+{
+	TiXmlDocument xmlDoc;
+	xmlDoc.LoadFile(xmlFileName);
 
-	TiXmlNode *root = _xmlDoc.FirstChild("GUPOptions");
+	TiXmlNode *root = xmlDoc.FirstChild("GUPOptions");
 	if (!root)
 		return;
 		
@@ -282,43 +827,664 @@ GupExtraOptions::GupExtraOptions(const char * xmlFileName) : _proxyServer(""), _
 			}
 		}
 	}
+
+	TiXmlNode *bandwidthNode = root->FirstChildElement("Bandwidth");
+	if (bandwidthNode)
+	{
+		// In KB/s in the file
+		string maxRate = getChildText(bandwidthNode, "maxRate");
+		if (atol(maxRate.c_str()) > 0)
+			_maxRate = static_cast<int64_t>(atol(maxRate.c_str())) * 1024;
+
+		_isBackground = stricmp(getChildText(bandwidthNode, "background").c_str(), "yes") == 0;
+	}
+
+	TiXmlNode *downloadNode = root->FirstChildElement("Download");
+	if (downloadNode)
+	{
+		TiXmlNode *segmentsNode = downloadNode->FirstChildElement("segments");
+		if (segmentsNode)
+		{
+			TiXmlNode *segments = segmentsNode->FirstChild();
+			if (segments)
+			{
+				const char *val = segments->Value();
+				if (val && atoi(val) > 0)
+					_segmentCount = atoi(val);
+			}
+		}
+
+		// In KB/s in the file
+		string minSpeed = getChildText(downloadNode, "minSpeed");
+		if (atol(minSpeed.c_str()) > 0)
+			_minSpeed = atol(minSpeed.c_str()) * 1024;
+
+		string minSpeedTime = getChildText(downloadNode, "minSpeedTime");
+		if (atol(minSpeedTime.c_str()) > 0)
+			_minSpeedTime = atol(minSpeedTime.c_str());
+
+		TiXmlNode *deltaNode = downloadNode->FirstChildElement("delta");
+		if (deltaNode)
+		{
+			TiXmlNode *delta = deltaNode->FirstChild();
+			if (delta)
+			{
+				const char *val = delta->Value();
+				if (val && stricmp(val, "no") == 0)
+					_isDeltaEnabled = false;
+			}
+		}
+
+		_isPrefetchEnabled = stricmp(getChildText(downloadNode, "prefetch").c_str(), "yes") == 0;
+	}
+
+	TiXmlNode *sourcesNode = root->FirstChildElement("Sources");
+	if (sourcesNode)
+	{
+		for (TiXmlElement *sourceNode = sourcesNode->FirstChildElement("source"); sourceNode; sourceNode = sourceNode->NextSiblingElement("source"))
+		{
+			TiXmlNode *sn = sourceNode->FirstChild();
+			const char *val = sn ? sn->Value() : NULL;
+			if (!val || !(*val))
+				continue;
+
+			GupPackageSource source;
+			source.location = val;
+			if (source.location.back() != '/')
+				source.location += '/';
+			const char *publish = sourceNode->Attribute("publish");
+			source.isPublished = publish && stricmp(publish, "yes") == 0;
+			_packageSources.push_back(source);
+		}
+	}
+
+	TiXmlNode *checkNode = root->FirstChildElement("Check");
+	if (checkNode)
+	{
+		string timeout = getChildText(checkNode, "timeout");
+		if (atol(timeout.c_str()) > 0)
+			_checkTimeout = atol(timeout.c_str());
+
+		string connectTimeout = getChildText(checkNode, "connectTimeout");
+		if (atol(connectTimeout.c_str()) > 0)
+			_checkConnectTimeout = atol(connectTimeout.c_str());
+
+		_isLowPriority = stricmp(getChildText(checkNode, "lowPriority").c_str(), "yes") == 0;
+		_isBinaryManifestEnabled = stricmp(getChildText(checkNode, "binaryManifest").c_str(), "no") != 0;
+	}
+
+	TiXmlNode *logNode = root->FirstChildElement("Log");
+	if (logNode)
+		_logPath = getChildText(logNode, "file");
+
+	TiXmlNode *cacheNode = root->FirstChildElement("Cache");
+	if (cacheNode)
+	{
+		TiXmlNode *dirNode = cacheNode->FirstChildElement("dir");
+		if (dirNode)
+		{
+			TiXmlNode *dir = dirNode->FirstChild();
+			if (dir)
+			{
+				const char *val = dir->Value();
+				if (val)
+					_cacheDir = val;
+			}
+		}
+
+		TiXmlNode *updateInfoNode = cacheNode->FirstChildElement("updateInfo");
+		if (updateInfoNode)
+		{
+			TiXmlNode *updateInfo = updateInfoNode->FirstChild();
+			if (updateInfo)
+			{
+				const char *val = updateInfo->Value();
+				if (val && stricmp(val, "no") == 0)
+					_isInfoCacheEnabled = false;
+			}
+		}
+	}
+}
+
+//
+// Snapshot of the values read from a configuration file, kept next to it (<file>.snapshot): the next runs read it
+// instead of parsing the XML, as long as the file has the same size and modification time.
+// "GUPC", the schema byte, then as varints the size and the modification time of the XML file and the size of the
+// records which follow, in the format of the binary manifest. The schema is bumped whenever what is read changes.
+// Anything wrong with the snapshot and the XML is parsed, then the snapshot written again.
+//
+const char SNAPSHOT_MAGIC[] = "GUPC";
+const size_t SNAPSHOT_MAGIC_SIZE = 4;
+const unsigned char SNAPSHOT_SCHEMA = 1;
+const char SNAPSHOT_EXTENSION[] = ".snapshot";
+
+enum ParametersSnapshotTag
+{
+	paramsCurrentVersion = 1,
+	paramsParam,
+	paramsInfoUrl,
+	paramsIsInfoStatic,
+	paramsPublicKey,
+	paramsChannel,
+	paramsClassName2Close,
+	paramsMessageBoxTitle,
+	paramsSoftwareName,
+	paramsSoftwareIcon,
+	paramsIsMessageBoxModal,
+	params3rdButtonCmd,
+	params3rdButtonWparam,
+	params3rdButtonLparam,
+	params3rdButtonLabel,
+	paramsIsSilentMode
+};
+
+enum OptionsSnapshotTag
+{
+	optionsProxyServer = 1,
+	optionsPort,
+	optionsMaxRate,
+	optionsIsBackground,
+	optionsSegmentCount,
+	optionsMinSpeed,
+	optionsMinSpeedTime,
+	optionsIsDeltaEnabled,
+	optionsIsPrefetchEnabled,
+	optionsPackageSource,
+	optionsPublishedPackageSource,
+	optionsCheckTimeout,
+	optionsCheckConnectTimeout,
+	optionsIsLowPriority,
+	optionsIsBinaryManifestEnabled,
+	optionsCacheDir,
+	optionsIsInfoCacheEnabled,
+	optionsLogPath
+};
+
+// Size and modification time of the file, in the units of the system
+static GupFileStamp getFileStamp(const char *path)
+{
+	GupFileStamp stamp;
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!::GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+		return stamp;
+
+	stamp.size = (static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	stamp.modified = (static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return stamp;
+
+	stamp.size = static_cast<uint64_t>(st.st_size);
+	stamp.modified = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+#endif
+	stamp.isValid = true;
+	return stamp;
+}
+
+// The records of the snapshot of this file, if it's still the one of its current content (stamp: the one
+// of the file now, for the snapshot written after parsing it otherwise)
+static bool readSnapshot(const char *xmlFileName, std::string & records, GupFileStamp & stamp)
+{
+	stamp = getFileStamp(xmlFileName);
+	if (!stamp.isValid)
+		return false;
+
+	FILE *f = fopen((string(xmlFileName) + SNAPSHOT_EXTENSION).c_str(), "rb");
+	if (!f)
+		return false;
+
+	string snapshot;
+	char buffer[4096];
+	size_t len = 0;
+	while ((len = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		snapshot.append(buffer, len);
+	fclose(f);
+
+	if (snapshot.compare(0, SNAPSHOT_MAGIC_SIZE, SNAPSHOT_MAGIC) != 0 || snapshot.size() <= SNAPSHOT_MAGIC_SIZE ||
+		static_cast<unsigned char>(snapshot[SNAPSHOT_MAGIC_SIZE]) != SNAPSHOT_SCHEMA)
+		return false;
+
+	try {
+		size_t pos = SNAPSHOT_MAGIC_SIZE + 1;
+		if (ManifestReader::readVarint(snapshot, pos) != stamp.size || ManifestReader::readVarint(snapshot, pos) != stamp.modified)
+			return false;
+
+		// A snapshot cut short by another run writing it at the same time
+		if (ManifestReader::readVarint(snapshot, pos) != snapshot.size() - pos)
+			return false;
+
+		records = snapshot.substr(pos);
+		return true;
+	}
+	catch (const exception &)
+	{
+		return false;
+	}
+}
+
+// A snapshot which can't be written (read-only directory) only means the next run parses the XML again
+static void writeSnapshot(const char *xmlFileName, const std::string & records, const GupFileStamp & stamp)
+{
+	if (!stamp.isValid)
+		return;
+
+	string snapshot(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_SIZE);
+	snapshot += static_cast<char>(SNAPSHOT_SCHEMA);
+	writeVarint(snapshot, stamp.size);
+	writeVarint(snapshot, stamp.modified);
+	writeVarint(snapshot, records.size());
+	snapshot += records;
+
+	FILE *f = fopen((string(xmlFileName) + SNAPSHOT_EXTENSION).c_str(), "wb");
+	if (!f)
+		return;
+	fwrite(snapshot.data(), 1, snapshot.size(), f);
+	fclose(f);
+}
+
+bool GupParameters::loadSnapshot(const char * xmlFileName, GupFileStamp & stamp)
+{
+	string records;
+	if (!readSnapshot(xmlFileName, records, stamp))
+		return false;
+
+	try {
+		ManifestReader reader(records, 0);
+		int tag = 0;
+		string value;
+		while (reader.next(tag, value))
+		{
+			switch (tag)
+			{
+				case paramsCurrentVersion: _currentVersion = value; break;
+				case paramsParam: _param = value; break;
+				case paramsInfoUrl: _infoUrl = value; break;
+				case paramsIsInfoStatic: _isInfoStatic = ManifestReader::toNumber(value) != 0; break;
+				case paramsPublicKey: _publicKeys.push_back(value); break;
+				case paramsChannel: _channel = value; break;
+				case paramsClassName2Close: _className2Close = value; break;
+				case paramsMessageBoxTitle: _messageBoxTitle = value; break;
+				case paramsSoftwareName: _softwareName = value; break;
+				case paramsSoftwareIcon: _softwareIcon = value; break;
+				case paramsIsMessageBoxModal: _isMessageBoxModal = ManifestReader::toNumber(value) != 0; break;
+				case params3rdButtonCmd: _3rdButton_wm_cmd = static_cast<int>(toSignedNumber(value)); break;
+				case params3rdButtonWparam: _3rdButton_wParam = static_cast<int>(toSignedNumber(value)); break;
+				case params3rdButtonLparam: _3rdButton_lParam = static_cast<int>(toSignedNumber(value)); break;
+				case params3rdButtonLabel: _3rdButton_label = value; break;
+				case paramsIsSilentMode: _isSilentMode = ManifestReader::toNumber(value) != 0; break;
+			}
+		}
+	}
+	catch (const exception &)
+	{
+		*this = GupParameters();
+		return false;
+	}
+
+	// InfoUrl is mandatory, as in the XML
+	if (_infoUrl.empty())
+	{
+		*this = GupParameters();
+		return false;
+	}
+	return true;
+}
+
+void GupParameters::saveSnapshot(const char * xmlFileName, const GupFileStamp & stamp) const
+{
+	string records;
+	writeRecord(records, paramsCurrentVersion, _currentVersion);
+	writeRecord(records, paramsParam, _param);
+	writeRecord(records, paramsInfoUrl, _infoUrl);
+	writeNumber(records, paramsIsInfoStatic, _isInfoStatic);
+	for (const string & publicKey : _publicKeys)
+		writeRecord(records, paramsPublicKey, publicKey);
+	writeRecord(records, paramsChannel, _channel);
+	writeRecord(records, paramsClassName2Close, _className2Close);
+	writeRecord(records, paramsMessageBoxTitle, _messageBoxTitle);
+	writeRecord(records, paramsSoftwareName, _softwareName);
+	writeRecord(records, paramsSoftwareIcon, _softwareIcon);
+	writeNumber(records, paramsIsMessageBoxModal, _isMessageBoxModal);
+	writeSignedNumber(records, params3rdButtonCmd, _3rdButton_wm_cmd);
+	writeSignedNumber(records, params3rdButtonWparam, _3rdButton_wParam);
+	writeSignedNumber(records, params3rdButtonLparam, _3rdButton_lParam);
+	writeRecord(records, params3rdButtonLabel, _3rdButton_label);
+	writeNumber(records, paramsIsSilentMode, _isSilentMode);
+	writeSnapshot(xmlFileName, records, stamp);
+}
+
+bool GupExtraOptions::loadSnapshot(const char * xmlFileName, GupFileStamp & stamp)
+{
+	string records;
+	if (!readSnapshot(xmlFileName, records, stamp))
+		return false;
+
+	try {
+		ManifestReader reader(records, 0);
+		int tag = 0;
+		string value;
+		while (reader.next(tag, value))
+		{
+			switch (tag)
+			{
+				case optionsProxyServer: _proxyServer = value; break;
+				case optionsPort: _port = static_cast<long>(toSignedNumber(value)); break;
+				case optionsMaxRate: _maxRate = toSignedNumber(value); break;
+				case optionsIsBackground: _isBackground = ManifestReader::toNumber(value) != 0; break;
+				case optionsSegmentCount: _segmentCount = static_cast<int>(toSignedNumber(value)); break;
+				case optionsMinSpeed: _minSpeed = static_cast<long>(toSignedNumber(value)); break;
+				case optionsMinSpeedTime: _minSpeedTime = static_cast<long>(toSignedNumber(value)); break;
+				case optionsIsDeltaEnabled: _isDeltaEnabled = ManifestReader::toNumber(value) != 0; break;
+				case optionsIsPrefetchEnabled: _isPrefetchEnabled = ManifestReader::toNumber(value) != 0; break;
+				case optionsPackageSource:
+				case optionsPublishedPackageSource:
+				{
+					GupPackageSource source;
+					source.location = value;
+					source.isPublished = tag == optionsPublishedPackageSource;
+					_packageSources.push_back(source);
+					break;
+				}
+				case optionsCheckTimeout: _checkTimeout = static_cast<long>(toSignedNumber(value)); break;
+				case optionsCheckConnectTimeout: _checkConnectTimeout = static_cast<long>(toSignedNumber(value)); break;
+				case optionsIsLowPriority: _isLowPriority = ManifestReader::toNumber(value) != 0; break;
+				case optionsIsBinaryManifestEnabled: _isBinaryManifestEnabled = ManifestReader::toNumber(value) != 0; break;
+				case optionsCacheDir: _cacheDir = value; break;
+				case optionsIsInfoCacheEnabled: _isInfoCacheEnabled = ManifestReader::toNumber(value) != 0; break;
+				case optionsLogPath: _logPath = value; break;
+			}
+		}
+	}
+	catch (const exception &)
+	{
+		*this = GupExtraOptions();
+		return false;
+	}
+	return true;
+}
+
+void GupExtraOptions::saveSnapshot(const char * xmlFileName, const GupFileStamp & stamp) const
+{
+	string records;
+	writeRecord(records, optionsProxyServer, _proxyServer);
+	writeSignedNumber(records, optionsPort, _port);
+	writeSignedNumber(records, optionsMaxRate, _maxRate);
+	writeNumber(records, optionsIsBackground, _isBackground);
+	writeSignedNumber(records, optionsSegmentCount, _segmentCount);
+	writeSignedNumber(records, optionsMinSpeed, _minSpeed);
+	writeSignedNumber(records, optionsMinSpeedTime, _minSpeedTime);
+	writeNumber(records, optionsIsDeltaEnabled, _isDeltaEnabled);
+	writeNumber(records, optionsIsPrefetchEnabled, _isPrefetchEnabled);
+	for (const GupPackageSource & source : _packageSources)
+		writeRecord(records, source.isPublished ? optionsPublishedPackageSource : optionsPackageSource, source.location);
+	writeSignedNumber(records, optionsCheckTimeout, _checkTimeout);
+	writeSignedNumber(records, optionsCheckConnectTimeout, _checkConnectTimeout);
+	writeNumber(records, optionsIsLowPriority, _isLowPriority);
+	writeNumber(records, optionsIsBinaryManifestEnabled, _isBinaryManifestEnabled);
+	writeRecord(records, optionsCacheDir, _cacheDir);
+	writeNumber(records, optionsIsInfoCacheEnabled, _isInfoCacheEnabled);
+	writeRecord(records, optionsLogPath, _logPath);
+	writeSnapshot(xmlFileName, records, stamp);
 }
 
 void GupExtraOptions::writeProxyInfo(const char *fn, const char *proxySrv, long port)
 {
+	// Keep the other options (Download...) of the existing file
 	TiXmlDocument newProxySettings(fn);
-	TiXmlNode *root = newProxySettings.InsertEndChild(TiXmlElement("GUPOptions"));
+	newProxySettings.LoadFile();
+
+	TiXmlNode *root = newProxySettings.FirstChild("GUPOptions");
+	if (!root)
+		root = newProxySettings.InsertEndChild(TiXmlElement("GUPOptions"));
+
+	TiXmlNode *oldProxy = root->FirstChildElement("Proxy");
+	if (oldProxy)
+		root->RemoveChild(oldProxy);
+
 	TiXmlNode *proxy = root->InsertEndChild(TiXmlElement("Proxy"));
 	TiXmlNode *server = proxy->InsertEndChild(TiXmlElement("server"));
 	server->InsertEndChild(TiXmlText(proxySrv));
 	TiXmlNode *portNode = proxy->InsertEndChild(TiXmlElement("port"));
 	char portStr[10];
-	sprintf(portStr, "%d", port);
+	sprintf(portStr, "%ld", port);
 	portNode->InsertEndChild(TiXmlText(portStr));
 
 	newProxySettings.SaveFile();
 }
 
-std::string GupNativeLang::getMessageString(std::string msgID)
+bool GupPartialDownload::load(const char * xmlFileName)
 {
-	if (!_nativeLangRoot)
-		return "";
+	TiXmlDocument xmlDoc;
+	if (!xmlDoc.LoadFile(xmlFileName))
+		return false;
 
-	TiXmlNode *popupMessagesNode = _nativeLangRoot->FirstChildElement("PopupMessages");
-	if (!popupMessagesNode)
-		return "";
+	TiXmlNode *root = xmlDoc.FirstChild("GUPPartialDownload");
+	if (!root)
+		return false;
 
-	TiXmlNode *node = popupMessagesNode->FirstChildElement(msgID.c_str());
-	if (!node)
-		return "";
+	_url = getChildText(root, "Url");
+	_etag = getChildText(root, "ETag");
+	_lastModified = getChildText(root, "LastModified");
 
-	TiXmlNode *sn = node->FirstChild();
-	if (!sn)
-		return "";
-		
-	const char *val = sn->Value();
-	if (!val || !(*val))
-		return "";
-	
-	return val;
+	string size = getChildText(root, "Size");
+	_size = size.empty() ? -1 : strtoll(size.c_str(), NULL, 10);
+
+	_received = strtoll(getChildText(root, "Received").c_str(), NULL, 10);
+	_hashState = getChildText(root, "Sha256State");
+	return !_url.empty() && _received >= 0;
+}
+
+bool GupPartialDownload::save(const char * xmlFileName) const
+{
+	TiXmlDocument xmlDoc(xmlFileName);
+	TiXmlNode *root = xmlDoc.InsertEndChild(TiXmlElement("GUPPartialDownload"));
+	addChildText(root, "Url", _url);
+	if (!_etag.empty())
+		addChildText(root, "ETag", _etag);
+	if (!_lastModified.empty())
+		addChildText(root, "LastModified", _lastModified);
+	if (_size >= 0)
+		addChildText(root, "Size", to_string(_size));
+	addChildText(root, "Received", to_string(_received));
+	if (!_hashState.empty())
+		addChildText(root, "Sha256State", _hashState);
+
+	return xmlDoc.SaveFile();
+}
+
+std::string GupPartialDownload::getIfRange() const
+{
+	// Weak validators (W/"...") are not allowed in If-Range
+	if (!_etag.empty() && _etag.compare(0, 2, "W/") != 0)
+		return _etag;
+	return _lastModified;
+}
+
+// Keep the answers of a few InfoUrl (several programs may share the cache directory)
+const size_t INFOCACHE_MAX_ENTRIES = 16;
+
+bool GupInfoCache::load(const char * xmlFileName)
+{
+	_entries.clear();
+
+	TiXmlDocument xmlDoc;
+	if (!xmlDoc.LoadFile(xmlFileName))
+		return false;
+
+	TiXmlNode *root = xmlDoc.FirstChild("GUPInfoCache");
+	if (!root)
+		return false;
+
+	for (TiXmlElement *entryNode = root->FirstChildElement("Entry"); entryNode; entryNode = entryNode->NextSiblingElement("Entry"))
+	{
+		GupInfoCacheEntry entry;
+		entry.url = getChildText(entryNode, "Url");
+		entry.etag = getChildText(entryNode, "ETag");
+		entry.lastModified = getChildText(entryNode, "LastModified");
+		entry.signature = getChildText(entryNode, "Signature");
+		entry.body = getChildText(entryNode, "Body");
+		// A binary manifest can't be XML text
+		if (entry.body.empty())
+			entry.body = fromHex(getChildText(entryNode, "BinaryBody"));
+		entry.fetchedAt = strtoll(getChildText(entryNode, "FetchedAt").c_str(), NULL, 10);
+		entry.maxAge = strtoll(getChildText(entryNode, "MaxAge").c_str(), NULL, 10);
+
+		if (!entry.url.empty() && !entry.body.empty())
+			_entries.push_back(entry);
+	}
+	return true;
+}
+
+bool GupInfoCache::save(const char * xmlFileName) const
+{
+	TiXmlDocument xmlDoc(xmlFileName);
+	TiXmlNode *root = xmlDoc.InsertEndChild(TiXmlElement("GUPInfoCache"));
+
+	for (const GupInfoCacheEntry & entry : _entries)
+	{
+		TiXmlNode *entryNode = root->InsertEndChild(TiXmlElement("Entry"));
+		addChildText(entryNode, "Url", entry.url);
+		if (!entry.etag.empty())
+			addChildText(entryNode, "ETag", entry.etag);
+		if (!entry.lastModified.empty())
+			addChildText(entryNode, "LastModified", entry.lastModified);
+		if (!entry.signature.empty())
+			addChildText(entryNode, "Signature", entry.signature);
+		addChildText(entryNode, "FetchedAt", to_string(entry.fetchedAt));
+		addChildText(entryNode, "MaxAge", to_string(entry.maxAge));
+		if (GupDownloadInfo::isManifest(entry.body))
+			addChildText(entryNode, "BinaryBody", toHex(entry.body));
+		else
+			addChildText(entryNode, "Body", entry.body);
+	}
+
+	return xmlDoc.SaveFile();
+}
+
+GupInfoCacheEntry * GupInfoCache::find(const std::string & url)
+{
+	for (GupInfoCacheEntry & entry : _entries)
+	{
+		if (entry.url == url)
+			return &entry;
+	}
+	return NULL;
+}
+
+void GupInfoCache::put(const GupInfoCacheEntry & entry)
+{
+	GupInfoCacheEntry newEntry = entry;
+	remove(entry.url);
+
+	_entries.insert(_entries.begin(), newEntry);
+	if (_entries.size() > INFOCACHE_MAX_ENTRIES)
+		_entries.resize(INFOCACHE_MAX_ENTRIES);
+}
+
+void GupInfoCache::remove(const std::string & url)
+{
+	for (auto it = _entries.begin(); it != _entries.end(); ++it)
+	{
+		if (it->url == url)
+		{
+			_entries.erase(it);
+			return;
+		}
+	}
+}
+
+bool GupCheckSchedule::load(const char * xmlFileName)
+{
+	TiXmlDocument xmlDoc;
+	if (!xmlDoc.LoadFile(xmlFileName))
+		return false;
+
+	TiXmlNode *root = xmlDoc.FirstChild("GUPSchedule");
+	if (!root)
+		return false;
+
+	string seed = getChildText(root, "Seed");
+	_hasSeed = !seed.empty();
+	_seed = static_cast<uint32_t>(strtoul(seed.c_str(), NULL, 10));
+	_nextCheck = strtoll(getChildText(root, "NextCheck").c_str(), NULL, 10);
+	return true;
+}
+
+bool GupCheckSchedule::save(const char * xmlFileName) const
+{
+	TiXmlDocument xmlDoc(xmlFileName);
+	TiXmlNode *root = xmlDoc.InsertEndChild(TiXmlElement("GUPSchedule"));
+	if (_hasSeed)
+		addChildText(root, "Seed", to_string(_seed));
+	addChildText(root, "NextCheck", to_string(_nextCheck));
+	return xmlDoc.SaveFile();
+}
+
+void GupCheckSchedule::makeSeed()
+{
+	if (_hasSeed)
+		return;
+
+	random_device device;
+	_seed = device();
+	_hasSeed = true;
+	_isSeedNew = true;
+}
+
+void GupCheckSchedule::deferCheck(int64_t now, int64_t delay)
+{
+	if (delay <= 0)
+	{
+		_nextCheck = 0;
+		return;
+	}
+
+	// All the clients told to come back in an hour don't come back at the same second
+	makeSeed();
+	_nextCheck = now + delay + static_cast<int64_t>(delay * (_seed / 4294967296.0));
+}
+
+bool GupCheckSchedule::isInRollout(const std::string & version, int percent)
+{
+	if (percent >= 100)
+		return true;
+
+	// FNV-1a of the version, from the seed
+	makeSeed();
+	uint32_t hash = 2166136261u ^ _seed;
+	for (char c : version)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 16777619u;
+	}
+	return static_cast<int>(hash % 100) < percent;
+}
+
+std::string GupNativeLang::getMessageString(const std::string & msgID)
+{
+	if (!_isLoaded)
+	{
+		// All the messages at once, there are only a few of them
+		_isLoaded = true;
+		TiXmlDocument xmlDoc;
+		xmlDoc.LoadFile(_xmlFileName.c_str());
+
+		TiXmlNode *nativeLangRoot = xmlDoc.FirstChild("GUP_NativeLangue");
+		TiXmlNode *popupMessagesNode = nativeLangRoot ? nativeLangRoot->FirstChildElement("PopupMessages") : NULL;
+		if (popupMessagesNode)
+		{
+			for (TiXmlElement *node = popupMessagesNode->FirstChildElement(); node; node = node->NextSiblingElement())
+			{
+				TiXmlNode *sn = node->FirstChild();
+				const char *val = sn ? sn->Value() : NULL;
+				if (val && *val)
+					_messages.insert(make_pair(string(node->Value()), string(val)));
+			}
+		}
+	}
+
+	auto message = _messages.find(msgID);
+	return message != _messages.end() ? message->second : "";
 }
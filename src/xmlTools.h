@@ -17,17 +17,31 @@
  along with GUP.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef XMLTOOLS_H
+#define XMLTOOLS_H
+
 #include "tinyxml.h"
+#include <stdint.h>
+#include <map>
 #include <string>
+#include <vector>
 
+//
+// The configuration files are read in their constructor: the few values needed are copied out of the
+// document, which is dropped right away. Only GupNativeLang waits for a message to be displayed.
+// GupParameters and GupExtraOptions keep what they've read in a snapshot next to the file, read instead of
+// the XML until the file changes.
+//
 
-class XMLTool {
-
-protected:
-	TiXmlDocument _xmlDoc;
+// Size and modification time of a configuration file, taken before it's read: a change made while it's
+// parsed leaves a snapshot which doesn't match the file
+struct GupFileStamp {
+	uint64_t size = 0;
+	uint64_t modified = 0;
+	bool isValid = false;
 };
 
-class GupParameters : public XMLTool {
+class GupParameters {
 public:
 	GupParameters() {};
 	GupParameters(const char * xmlFileName);
@@ -35,6 +49,7 @@ public:
 	const std::string & getCurrentVersion() const { return _currentVersion;};
 	const std::string & getParam() const { return _param; };
 	const std::string & getInfoLocation() const {return _infoUrl;};
+	bool isInfoStatic() const { return _isInfoStatic; };
 	const std::string & getClassName() const {return _className2Close;};
 	const std::string & getMessageBoxTitle() const {return _messageBoxTitle;};
 	const std::string & getSoftwareName() const {return _softwareName;};
@@ -43,8 +58,14 @@ public:
 	int get3rdButtonWparam() const {return _3rdButton_wParam;};
 	int get3rdButtonLparam() const {return _3rdButton_lParam;};
 	const std::string & get3rdButtonLabel() const { return _3rdButton_label; };
+	// Ed25519 keys (hexadecimal) the update info and the packages have to be signed with, none: signatures aren't checked
+	const std::vector<std::string> & getPublicKeys() const { return _publicKeys; };
+	// Release channel ("beta"...) taken from a static manifest, empty: only its main release
+	const std::string & getChannel() const { return _channel; };
 
 	void setCurrentVersion(const char *currentVersion) {_currentVersion = currentVersion;};
+	void setParam(const char *param) {_param = param;};
+	void setChannel(const char *channel) {_channel = channel;};
 	bool setSilentMode(bool mode) {
 		bool oldMode = _isSilentMode;
 		_isSilentMode = mode;
@@ -54,9 +75,17 @@ public:
 	bool isMessageBoxModal() const { return _isMessageBoxModal; };
 
 private:
+	void parseXml(const char * xmlFileName);
+	// The values read from the file by a previous run, see readSnapshot
+	bool loadSnapshot(const char * xmlFileName, GupFileStamp & stamp);
+	void saveSnapshot(const char * xmlFileName, const GupFileStamp & stamp) const;
+
 	std::string _currentVersion;
 	std::string _param;
 	std::string _infoUrl;
+	bool _isInfoStatic = false;
+	std::vector<std::string> _publicKeys;
+	std::string _channel;
 	std::string _className2Close;
 	std::string _messageBoxTitle;
 	std::string _softwareName;
@@ -69,7 +98,13 @@ private:
 	bool _isSilentMode = true;
 };
 
-class GupExtraOptions : public XMLTool {
+// A copy of the update packages on the local network, tried before the Location of the update info
+struct GupPackageSource {
+	std::string location;      // the package name is appended to it: file://fileserver/updates/, http://cache.lan/updates/
+	bool isPublished = false;  // a package downloaded from further away is copied there for the next machines
+};
+
+class GupExtraOptions {
 public:
 	GupExtraOptions(const char * xmlFileName);
 	const std::string & getProxyServer() const { return _proxyServer;};
@@ -77,35 +112,235 @@ public:
 	bool hasProxySettings() const {return ((!_proxyServer.empty()) && (_port != -1));};
 	void writeProxyInfo(const char *fn, const char *proxySrv, long port);
 
+	int64_t getMaxRate() const { return _maxRate; };
+	bool isBackground() const { return _isBackground; };
+
+	int getSegmentCount() const { return _segmentCount; };
+	long getMinSpeed() const { return _minSpeed; };
+	long getMinSpeedTime() const { return _minSpeedTime; };
+	bool isDeltaEnabled() const { return _isDeltaEnabled; };
+	bool isPrefetchEnabled() const { return _isPrefetchEnabled; };
+	// In the order they're tried
+	const std::vector<GupPackageSource> & getPackageSources() const { return _packageSources; };
+	long getCheckTimeout() const { return _checkTimeout; };
+	long getCheckConnectTimeout() const { return _checkConnectTimeout; };
+	bool isLowPriority() const { return _isLowPriority; };
+	bool isBinaryManifestEnabled() const { return _isBinaryManifestEnabled; };
+	const std::string & getCacheDir() const { return _cacheDir; };
+	bool isInfoCacheEnabled() const { return _isInfoCacheEnabled; };
+	const std::string & getLogPath() const { return _logPath; };
+
 private:
+	GupExtraOptions() : _proxyServer(""), _port(-1) {};
+	void parseXml(const char * xmlFileName);
+	bool loadSnapshot(const char * xmlFileName, GupFileStamp & stamp);
+	void saveSnapshot(const char * xmlFileName, const GupFileStamp & stamp) const;
+
 	std::string _proxyServer;
 	long _port;
+	int64_t _maxRate = 0;           // in bytes per second, 0: no cap
+	bool _isBackground = false;
+	int _segmentCount = 1;
+	long _minSpeed = 0;             // in bytes per second, 0: no floor
+	long _minSpeedTime = 10;        // in seconds
+	bool _isDeltaEnabled = true;
+	bool _isPrefetchEnabled = false;
+	std::vector<GupPackageSource> _packageSources;
+	long _checkTimeout = 0;         // in milliseconds, 0: no limit
+	long _checkConnectTimeout = 0;
+	bool _isLowPriority = false;
+	bool _isBinaryManifestEnabled = true;
+	std::string _cacheDir;
+	bool _isInfoCacheEnabled = true;
+	std::string _logPath;
 	//bool _hasProxySettings;
 };
 
-class GupDownloadInfo : public XMLTool {
+// Binary diff from the package of a previous version to the update package (see PatchApplier)
+struct GupDelta {
+	std::string from;        // the version the delta applies to
+	std::string location;    // of the delta
+	std::string base;        // location the package of the "from" version was downloaded from
+	std::string sha256;      // of the delta, optional
+};
+
+// One of the Location of the update package, all serving the same file
+struct GupMirror {
+	std::string location;
+	int weight = 1;          // preference among the mirrors, 0: only if all the others fail
+};
+
+//
+// Binary manifest: the compact form of the XML answer of InfoUrl, sent as application/x-gup-manifest.
+//   "GUPM", the schema version (1 byte), then records until the end: tag (1 byte), length (varint), value.
+//   Numbers are unsigned LEB128 varints, strings are UTF-8 without terminator, SHA-256 are the 32 raw bytes.
+//   1 NeedToBeUpdated (0/1, absent from a static manifest)  2 Version  3 Location  4 weight of the Location before  5 Hash
+//   6 Delta, whose value is records: 1 from  2 Location  3 Base  4 Hash
+//   7 RetryAfter  8 MinCheckInterval  9 Rollout  10 Signature (the 64 raw bytes)
+//   11 Channel of a static manifest, whose value is records: 12 its name, then 2 to 10 of its release
+// Unknown tags are skipped: a new field keeps the schema version, only a change old clients can't read bumps it.
+//
+class GupDownloadInfo {
 public:
 	GupDownloadInfo() : _updateVersion(""), _updateLocation("") {};
 	GupDownloadInfo(const char * xmlString);
+	// XML or binary manifest, told apart by their first bytes.
+	// The channel (see GupParameters::getChannel) picks a release of a static manifest
+	explicit GupDownloadInfo(const std::string & answer, const std::string & channel = "");
+
+	static bool isManifest(const std::string & answer);
+	// This update info as a binary manifest
+	std::string toManifest() const;
 	
 	const std::string & getVersion() const { return _updateVersion;};
 	const std::string & getDownloadLocation() const {return _updateLocation;};
+	// All the Location, in the order of the update info (the first one is getDownloadLocation())
+	const std::vector<GupMirror> & getMirrors() const {return _mirrors;};
+	// Expected SHA-256 of the package (lowercase hexadecimal), empty if the server doesn't tell
+	const std::string & getSha256() const {return _sha256;};
+	// Ed25519 signature (hexadecimal) of the raw SHA-256 of the package, empty if the server doesn't sign
+	const std::string & getSignature() const {return _signature;};
 	bool doesNeed2BeUpdated() const {return _need2BeUpdated;};
+	// A static manifest, without NeedToBeUpdated: only the client can tell, by compareVersion()
+	bool isStatic() const {return _isStatic;};
+	// Of a static manifest, there's an update if its version is after the current one (see GupVersion)
+	void compareVersion(const std::string & currentVersion);
+	// Channel the release comes from, empty for the main one
+	const std::string & getChannel() const {return _channel;};
+	// NULL if there is no delta from this version
+	const GupDelta * findDelta(const std::string & fromVersion) const;
+
+	// Server hints, in seconds (0 if absent): don't check again before RetryAfter, nor more often than MinCheckInterval
+	long getRetryAfter() const {return _retryAfter;};
+	long getMinCheckInterval() const {return _minCheckInterval;};
+	// Percentage of the machines the update is offered to for now (see GupCheckSchedule::isInRollout)
+	int getRollout() const {return _rollout;};
 
 private:
-	bool _need2BeUpdated;
+	bool _need2BeUpdated = false;
+	bool _isStatic = false;
 	std::string _updateVersion;
 	std::string _updateLocation;
+	std::vector<GupMirror> _mirrors;
+	std::string _sha256;
+	std::string _signature;
+	std::vector<GupDelta> _deltas;
+	long _retryAfter = 0;
+	long _minCheckInterval = 0;
+	int _rollout = 100;
+
+	std::string _channel;
+
+	void parseXml(const char * xmlString, const std::string & channel);
+	// Version, Location, Hash, Signature and Delta of node
+	void parseRelease(TiXmlNode *node);
+	void parseManifest(const std::string & manifest, const std::string & channel);
+	void parseManifestRecords(const std::string & records, size_t pos, bool & hasNeedToBeUpdated, std::vector<std::string> & channels);
+	void takeNewerRelease(GupDownloadInfo & release, const std::string & channel);
 };
 
-class GupNativeLang : public XMLTool {
+// State of an interrupted download, saved aside the partial package (<package>.part.xml)
+// so the next run can resume it instead of starting again from byte zero.
+class GupPartialDownload {
 public:
-	GupNativeLang(const char * xmlFileName) {
-		_xmlDoc.LoadFile(xmlFileName);
-		_nativeLangRoot = _xmlDoc.FirstChild("GUP_NativeLangue");
-	};
-	std::string getMessageString(std::string msgID);
+	GupPartialDownload() {};
+
+	bool load(const char * xmlFileName);
+	bool save(const char * xmlFileName) const;
 
-protected:
-	TiXmlNode *_nativeLangRoot;
+	const std::string & getUrl() const { return _url; };
+	const std::string & getETag() const { return _etag; };
+	const std::string & getLastModified() const { return _lastModified; };
+	int64_t getSize() const { return _size; };
+	int64_t getReceived() const { return _received; };
+	// SHA-256 of the received bytes so far (Sha256::saveState), empty if the package wasn't being verified
+	const std::string & getHashState() const { return _hashState; };
+
+	void setUrl(const std::string & url) { _url = url; };
+	void setValidators(const std::string & etag, const std::string & lastModified) { _etag = etag; _lastModified = lastModified; };
+	void setSize(int64_t size) { _size = size; };
+	void setReceived(int64_t received) { _received = received; };
+	void setHashState(const std::string & hashState) { _hashState = hashState; };
+
+	// What we send in If-Range: a strong ETag, or else the Last-Modified date
+	std::string getIfRange() const;
+	bool canResume() const { return _received > 0 && !getIfRange().empty(); };
+
+private:
+	std::string _url;
+	std::string _etag;
+	std::string _lastModified;
+	int64_t _size = -1;
+	int64_t _received = 0;
+	std::string _hashState;
 };
+
+// Last answers of InfoUrl, kept to send conditional requests (If-None-Match / If-Modified-Since)
+// and to skip the network while an answer is still fresh (Cache-Control: max-age).
+struct GupInfoCacheEntry {
+	std::string url;            // complete request url, version and param included
+	std::string etag;
+	std::string lastModified;
+	std::string signature;      // GUP-Signature header of the body
+	std::string body;
+	int64_t fetchedAt = 0;      // time(), in seconds
+	int64_t maxAge = 0;         // in seconds
+
+	bool isFresh(int64_t now) const { return now >= fetchedAt && now < fetchedAt + maxAge; };
+};
+
+class GupInfoCache {
+public:
+	bool load(const char * xmlFileName);
+	bool save(const char * xmlFileName) const;
+
+	GupInfoCacheEntry * find(const std::string & url);
+	void put(const GupInfoCacheEntry & entry);
+	void remove(const std::string & url);
+
+private:
+	std::vector<GupInfoCacheEntry> _entries;  // the most recent first
+};
+
+// When the server allows the next update check (Retry-After, MinCheckInterval), kept between runs (gupSchedule.xml)
+// with the random seed of this machine, which spreads the checks of all the clients over time.
+class GupCheckSchedule {
+public:
+	bool load(const char * xmlFileName);
+	bool save(const char * xmlFileName) const;
+
+	// time(), in seconds, 0: any time
+	int64_t getNextCheck() const { return _nextCheck; };
+	// Not before delay seconds from now, plus up to as much again depending on the seed (0: any time)
+	void deferCheck(int64_t now, int64_t delay);
+
+	// Whether this machine is among the given percentage of the machines offered the version.
+	// The same machines get it first while the percentage grows, not the same ones for every version.
+	bool isInRollout(const std::string & version, int percent);
+	// Whether the seed was drawn in this run, so that the schedule has to be saved to keep it
+	bool isSeedNew() const { return _isSeedNew; };
+
+private:
+	uint32_t _seed = 0;
+	bool _hasSeed = false;
+	bool _isSeedNew = false;
+	int64_t _nextCheck = 0;
+
+	void makeSeed();
+};
+
+// The translated messages of nativeLang.xml, read with the first one asked: a run which shows nothing
+// doesn't read the file
+class GupNativeLang {
+public:
+	GupNativeLang(const char * xmlFileName) : _xmlFileName(xmlFileName) {};
+	// Empty if the message isn't translated
+	std::string getMessageString(const std::string & msgID);
+
+private:
+	std::string _xmlFileName;
+	bool _isLoaded = false;
+	std::map<std::string, std::string> _messages;
+};
+
+#endif // XMLTOOLS_H